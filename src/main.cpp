@@ -2,14 +2,47 @@
 #include <cstdlib>
 #include <cstring>
 #include <cctype>
+#include <climits>
+#include <csignal>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+#include <set>
+#include <map>
+#include <array>
+#include <queue>
+#include <random>
+#include <tuple>
+#include <cmath>
+#include <charconv>
+#include <memory>
+#include <new>
+#include <functional>
 #include <fstream>
+#include <filesystem>
 #include <sstream>
 #include <iostream>
 
+#if defined(ASSET_TLS)
+  #include <openssl/ssl.h>
+  #include <openssl/err.h>
+  #include <openssl/x509v3.h>
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__)
+  #include <emmintrin.h>
+  #define ASSET_JSON_SSE2 1
+#endif
+
 #if defined(_WIN32)
   #ifndef WIN32_LEAN_AND_MEAN
   #define WIN32_LEAN_AND_MEAN
@@ -23,7 +56,10 @@
   #include <windows.h>
   #if defined(_MSC_VER)
     #pragma comment(lib, "ws2_32.lib")
+    #include <intrin.h>
   #endif
+  #include <io.h>
+  #include <fcntl.h>
 #else
   #include <unistd.h>
   #include <fcntl.h>
@@ -31,10 +67,19 @@
   #include <sys/socket.h>
   #include <netdb.h>
   #include <arpa/inet.h>
+  #include <netinet/tcp.h>
   #include <errno.h>
+  #include <signal.h>
   #include <sys/stat.h>
+  #include <sys/mman.h>
+  #include <sys/utsname.h>
+  #include <sys/statvfs.h>
+  #include <net/if.h>
+  #include <ifaddrs.h>
   #if defined(__linux__)
     #include <sys/sysinfo.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
   #endif
   #if defined(__APPLE__)
     #include <sys/sysctl.h>
@@ -42,11 +87,159 @@
 #endif
 
 // ------------------------------
-// logging helpers
+// logging (asynchronous, off the request path)
 // ------------------------------
-static void log_info(const std::string& msg) { std::cout << "[INFO] " << msg << "\n"; }
-static void log_warn(const std::string& msg) { std::cout << "[WARN] " << msg << "\n"; }
-static void log_err (const std::string& msg) { std::cerr << "[ERROR] " << msg << "\n"; }
+static std::string json_escape(const std::string& s);
+
+enum LogLevel { kLogDebug, kLogInfo, kLogWarn, kLogErr };
+
+// Callers hand finished lines to a bounded lock-free MPSC ring; one background thread formats
+// and writes them. Producers never wait: when the ring is full (stdout is a slow pipe, say)
+// the line is dropped and counted. Lines below the level are rejected before they are queued;
+// call sites that build an expensive message check log_enabled() first.
+class Logger {
+public:
+    static Logger& get() {
+        static Logger* l = new Logger(); // never destroyed: the flusher thread runs until exit
+        return *l;
+    }
+
+    void set_level(LogLevel l) { level_.store(l, std::memory_order_relaxed); }
+    void set_json(bool on) { json_.store(on, std::memory_order_relaxed); }
+    bool json() const { return json_.load(std::memory_order_relaxed); }
+    bool enabled(LogLevel l) const { return l >= level_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const {
+        return dropped_total_.load(std::memory_order_relaxed) + dropped_.load(std::memory_order_relaxed);
+    }
+
+    // `fields`, if any, are extra members for JSON output ("\"k\":v,..."); text output ignores them.
+    void write(LogLevel level, std::string msg, std::string fields = std::string()) {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        Slot* s;
+        for (;;) {
+            s = &ring_[pos & kMask];
+            const int64_t dif = (int64_t)s->seq.load(std::memory_order_acquire) - (int64_t)pos;
+            if (dif == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        s->level = level;
+        s->time = std::chrono::system_clock::now();
+        s->msg = std::move(msg);
+        s->fields = std::move(fields);
+        s->seq.store(pos + 1, std::memory_order_release);
+        if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)) cv_.notify_one();
+    }
+
+    // Writes out everything queued so far (at exit, and before a report goes to stdout).
+    void flush() {
+        std::lock_guard<std::mutex> lk(drain_mu_);
+        drain();
+    }
+
+private:
+    static const size_t kSlots = 16384, kMask = kSlots - 1;
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        LogLevel level;
+        std::chrono::system_clock::time_point time;
+        std::string msg, fields;
+    };
+
+    Logger() : ring_(new Slot[kSlots]) {
+        for (size_t i = 0; i < kSlots; i++) ring_[i].seq.store(i, std::memory_order_relaxed);
+        std::atexit([] { Logger::get().flush(); });
+        std::thread([this] { run(); }).detach();
+    }
+
+    bool ready() const {
+        const uint64_t pos = tail_.load(std::memory_order_relaxed);
+        return ring_[pos & kMask].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    void run() {
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lk(drain_mu_);
+                if (drain()) continue;
+            }
+            // A line queued between the check and the wait is picked up by the timeout at the latest.
+            std::unique_lock<std::mutex> lk(sleep_mu_);
+            sleeping_.store(true);
+            if (!ready()) cv_.wait_for(lk, std::chrono::milliseconds(100), [&] { return !sleeping_.load(); });
+            sleeping_.store(false);
+        }
+    }
+
+    // Called with drain_mu_ held. Returns whether anything was written.
+    bool drain() {
+        out_.clear();
+        err_.clear();
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        for (Slot* s; (s = &ring_[pos & kMask])->seq.load(std::memory_order_acquire) == pos + 1; pos++) {
+            format(s->level, s->time, s->msg, s->fields, s->level == kLogErr ? err_ : out_);
+            std::string().swap(s->msg);
+            std::string().swap(s->fields);
+            s->seq.store(pos + kSlots, std::memory_order_release);
+            tail_.store(pos + 1, std::memory_order_relaxed);
+        }
+        if (const uint64_t lost = dropped_.exchange(0, std::memory_order_relaxed)) {
+            dropped_total_.fetch_add(lost, std::memory_order_relaxed);
+            format(kLogWarn, std::chrono::system_clock::now(), std::to_string(lost) + " log line(s) dropped (output too slow)", std::string(), out_);
+        }
+        if (!out_.empty()) { std::fwrite(out_.data(), 1, out_.size(), stdout); std::fflush(stdout); }
+        if (!err_.empty()) { std::fwrite(err_.data(), 1, err_.size(), stderr); std::fflush(stderr); }
+        return !out_.empty() || !err_.empty();
+    }
+
+    void format(LogLevel level, std::chrono::system_clock::time_point time, const std::string& msg, const std::string& fields, std::string& out) const {
+        static const char* const kText[] = {"[DEBUG] ", "[INFO] ", "[WARN] ", "[ERROR] "};
+        static const char* const kJson[] = {"debug", "info", "warn", "error"};
+        if (!json()) {
+            out += kText[level]; out += msg; out += '\n';
+            return;
+        }
+        const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+        const std::time_t t = (std::time_t)(ms / 1000);
+        std::tm tm{};
+#if defined(_WIN32)
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        char ts[40];
+        const size_t n = std::strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+        std::snprintf(ts + n, sizeof(ts) - n, ".%03dZ", (int)(ms % 1000));
+        out += "{\"ts\":\""; out += ts;
+        out += "\",\"level\":\""; out += kJson[level];
+        out += "\",\"msg\":\""; out += json_escape(msg); out += '"';
+        if (!fields.empty()) { out += ','; out += fields; }
+        out += "}\n";
+    }
+
+    std::unique_ptr<Slot[]> ring_;
+    std::atomic<uint64_t> head_{0}; // next slot producers claim
+    std::atomic<uint64_t> tail_{0}; // next slot to write out (advanced under drain_mu_)
+    std::atomic<uint64_t> dropped_{0}, dropped_total_{0};
+    std::atomic<int> level_{kLogInfo};
+    std::atomic<bool> json_{false};
+    std::atomic<bool> sleeping_{false};
+    std::mutex drain_mu_, sleep_mu_;
+    std::condition_variable cv_;
+    std::string out_, err_;
+};
+
+static bool log_enabled(LogLevel l) { return Logger::get().enabled(l); }
+static void log_debug(std::string msg) { if (log_enabled(kLogDebug)) Logger::get().write(kLogDebug, std::move(msg)); }
+static void log_info(std::string msg) { if (log_enabled(kLogInfo)) Logger::get().write(kLogInfo, std::move(msg)); }
+static void log_warn(std::string msg) { if (log_enabled(kLogWarn)) Logger::get().write(kLogWarn, std::move(msg)); }
+static void log_err (std::string msg) { Logger::get().write(kLogErr, std::move(msg)); }
+static void log_flush() { Logger::get().flush(); }
 
 // ------------------------------
 // system info (best-effort)
@@ -124,68 +317,303 @@ static unsigned get_cpu_cores() {
 }
 
 // ------------------------------
-// tiny JSON build + schema check
+// tiny JSON build
 // ------------------------------
+// Control characters without a short escape (and DEL) become \u00XX, so request paths and
+// messages from clients can neither break a JSON line nor reach a terminal raw.
 static std::string json_escape(const std::string& s) {
-    std::ostringstream o;
+    static const char kHex[] = "0123456789abcdef";
+    std::string o;
+    o.reserve(s.size() + 8);
     for (char ch : s) {
         switch (ch) {
-            case '\\': o << "\\\\"; break;
-            case '"':  o << "\\\""; break;
-            case '\n': o << "\\n"; break;
-            case '\r': o << "\\r"; break;
-            case '\t': o << "\\t"; break;
-            default: o << ch;
+            case '\\': o += "\\\\"; break;
+            case '"':  o += "\\\""; break;
+            case '\n': o += "\\n"; break;
+            case '\r': o += "\\r"; break;
+            case '\t': o += "\\t"; break;
+            default:
+                if ((unsigned char)ch < 0x20 || ch == 0x7f) {
+                    o += "\\u00"; o += kHex[(unsigned char)ch >> 4]; o += kHex[ch & 0xf];
+                } else {
+                    o += ch;
+                }
+        }
+    }
+    return o;
+}
+
+// ------------------------------
+// single-pass JSON scanner for asset records
+// ------------------------------
+// Works directly on the request bytes: no allocation, every byte visited once.
+// String views below point into the scanned buffer and keep escape sequences as written.
+struct AssetView {
+    std::string_view id, hostname, os, cpu_cores, ram_mb, ip, timestamp;
+    bool has_id = false, has_hostname = false, has_os = false, has_timestamp = false;
+    long long cpu_cores_num = -1; // -1 when absent
+    long long ram_mb_num = -1;    // -1 when absent or "N/A"
+};
+
+static inline const char* json_skip_ws(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    return p;
+}
+
+// `p` points just past the opening quote. Returns the closing quote, or nullptr when the
+// string is unterminated or contains a raw control character / bad escape.
+static const char* json_scan_string(const char* p, const char* end) {
+    for (;;) {
+#if defined(ASSET_JSON_SSE2)
+        // 16 bytes at a time until something interesting ('"', '\\' or < 0x20) shows up.
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i bslash = _mm_set1_epi8('\\');
+        const __m128i ctl = _mm_set1_epi8(0x1f);
+        while (end - p >= 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i*)p);
+            const __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                                             _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl));
+            const int mask = _mm_movemask_epi8(hit);
+            if (mask) { p += __builtin_ctz((unsigned)mask); break; }
+            p += 16;
+        }
+#endif
+        if (p >= end) return nullptr;
+        const unsigned char c = (unsigned char)*p;
+        if (c == '"') return p;
+        if (c < 0x20) return nullptr;
+        if (c != '\\') { p++; continue; }
+        if (++p >= end) return nullptr;
+        switch (*p) {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                p++;
+                break;
+            case 'u':
+                if (end - p < 5) return nullptr;
+                for (int i = 1; i <= 4; i++) {
+                    if (!std::isxdigit((unsigned char)p[i])) return nullptr;
+                }
+                p += 5;
+                break;
+            default:
+                return nullptr;
+        }
+    }
+}
+
+// JSON number grammar. Sets *ival when the token is a plain integer that fits.
+static const char* json_scan_number(const char* p, const char* end, long long* ival, bool* is_int) {
+    const char* start = p;
+    bool neg = false;
+    if (p < end && *p == '-') { neg = true; p++; }
+    if (p >= end || !std::isdigit((unsigned char)*p)) return nullptr;
+    unsigned long long v = 0;
+    bool overflow = false;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < end && std::isdigit((unsigned char)*p)) {
+            if (v > (unsigned long long)(LLONG_MAX / 10)) overflow = true;
+            v = v * 10 + (unsigned)(*p - '0');
+            p++;
+        }
+    }
+    bool integer = true;
+    if (p < end && *p == '.') {
+        integer = false;
+        p++;
+        if (p >= end || !std::isdigit((unsigned char)*p)) return nullptr;
+        while (p < end && std::isdigit((unsigned char)*p)) p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integer = false;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (p >= end || !std::isdigit((unsigned char)*p)) return nullptr;
+        while (p < end && std::isdigit((unsigned char)*p)) p++;
+    }
+    if (p == start) return nullptr;
+    *is_int = integer && !overflow && v <= (unsigned long long)LLONG_MAX;
+    if (*is_int) *ival = neg ? -(long long)v : (long long)v;
+    return p;
+}
+
+static const char* json_skip_value(const char* p, const char* end, int depth);
+
+static const char* json_skip_container(const char* p, const char* end, int depth, char close) {
+    if (depth > 32) return nullptr;
+    p = json_skip_ws(p + 1, end);
+    if (p < end && *p == close) return p + 1;
+    for (;;) {
+        if (close == '}') {
+            if (p >= end || *p != '"') return nullptr;
+            p = json_scan_string(p + 1, end);
+            if (!p) return nullptr;
+            p = json_skip_ws(p + 1, end);
+            if (p >= end || *p != ':') return nullptr;
+            p = json_skip_ws(p + 1, end);
+        }
+        p = json_skip_value(p, end, depth + 1);
+        if (!p) return nullptr;
+        p = json_skip_ws(p, end);
+        if (p >= end) return nullptr;
+        if (*p == close) return p + 1;
+        if (*p != ',') return nullptr;
+        p = json_skip_ws(p + 1, end);
+    }
+}
+
+static const char* json_skip_value(const char* p, const char* end, int depth) {
+    if (p >= end) return nullptr;
+    switch (*p) {
+        case '"': { const char* q = json_scan_string(p + 1, end); return q ? q + 1 : nullptr; }
+        case '{': return json_skip_container(p, end, depth, '}');
+        case '[': return json_skip_container(p, end, depth, ']');
+        case 't': return (end - p >= 4 && std::memcmp(p, "true", 4) == 0) ? p + 4 : nullptr;
+        case 'f': return (end - p >= 5 && std::memcmp(p, "false", 5) == 0) ? p + 5 : nullptr;
+        case 'n': return (end - p >= 4 && std::memcmp(p, "null", 4) == 0) ? p + 4 : nullptr;
+        default: {
+            long long iv; bool is_int;
+            return json_scan_number(p, end, &iv, &is_int);
         }
     }
-    return o.str();
 }
 
-static bool json_has_required_keys(const std::string& body, std::string* why) {
-    auto has = [&](const char* k) {
-        std::string kk = "\"";
-        kk += k;
-        kk += "\"";
-        return body.find(kk) != std::string::npos;
+// Splits a JSON object into its top-level members: keys as they appear between the quotes
+// (still escaped) and values as raw text. Returns false when `body` is not one well-formed object.
+static bool json_object_fields(std::string_view body, std::vector<std::pair<std::string_view, std::string_view>>& out) {
+    const char* const end = body.data() + body.size();
+    const char* p = json_skip_ws(body.data(), end);
+    if (p >= end || *p != '{') return false;
+    p = json_skip_ws(p + 1, end);
+    if (p < end && *p == '}') return json_skip_ws(p + 1, end) == end;
+    for (;;) {
+        if (p >= end || *p != '"') return false;
+        const char* kq = json_scan_string(p + 1, end);
+        if (!kq) return false;
+        const std::string_view key(p + 1, (size_t)(kq - p - 1));
+        p = json_skip_ws(kq + 1, end);
+        if (p >= end || *p != ':') return false;
+        p = json_skip_ws(p + 1, end);
+        const char* v = p;
+        if (!(p = json_skip_value(p, end, 1))) return false;
+        out.emplace_back(key, std::string_view(v, (size_t)(p - v)));
+        p = json_skip_ws(p, end);
+        if (p < end && *p == ',') { p = json_skip_ws(p + 1, end); continue; }
+        return p < end && *p == '}' && json_skip_ws(p + 1, end) == end;
+    }
+}
+
+static const uint64_t kFnvOffset = 1469598103934665603ull;
+
+static uint64_t fnv1a64(uint64_t h, std::string_view s) {
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+    return h;
+}
+
+// Validates one asset object and pulls out the known fields in the same pass.
+// Unknown keys are allowed (and skipped, including nested values).
+static bool parse_asset_json(std::string_view body, AssetView& v, std::string* why) {
+    v = AssetView{};
+    const char* const begin = body.data();
+    const char* const end = begin + body.size();
+    auto fail = [&](const char* at, const char* what) {
+        if (why) { *why = what; *why += " (offset "; *why += std::to_string((long long)(at - begin)); *why += ")"; }
+        return false;
     };
-    if (body.size() < 2 || body.front() != '{' || body.back() != '}') {
+
+    const char* p = json_skip_ws(begin, end);
+    if (p >= end || *p != '{') {
         if (why) *why = "Body is not a JSON object.";
         return false;
     }
-    const char* req[] = {"hostname", "os", "timestamp"};
-    for (auto k : req) {
-        if (!has(k)) {
-            if (why) { *why = "Missing required key: "; *why += k; }
-            return false;
+    p = json_skip_ws(p + 1, end);
+    bool first = true;
+    while (p < end && *p != '}') {
+        if (!first) {
+            if (*p != ',') return fail(p, "Expected ',' or '}'");
+            p = json_skip_ws(p + 1, end);
         }
-    }
-    return true;
-}
+        first = false;
+        if (p >= end || *p != '"') return fail(p, "Expected object key");
+        const char* kq = json_scan_string(p + 1, end);
+        if (!kq) return fail(p, "Invalid string");
+        const std::string_view key(p + 1, (size_t)(kq - p - 1));
+        p = json_skip_ws(kq + 1, end);
+        if (p >= end || *p != ':') return fail(p, "Expected ':'");
+        p = json_skip_ws(p + 1, end);
+        if (p >= end) return fail(p, "Unexpected end of input");
 
-static std::string build_asset_json(const std::string& id, const std::string& ip_guess) {
-    const std::string hostname = get_hostname();
-    const std::string os = get_os_name();
-    const unsigned cores = get_cpu_cores();
-    const long long ram_mb = get_total_ram_mb();
-    const std::string ts = now_iso8601_local();
+        const char* vstart = p;
+        const bool is_string = *p == '"';
+        std::string_view* slot = nullptr;
+        bool* present = nullptr;
+        if (key == "id") { slot = &v.id; present = &v.has_id; }
+        else if (key == "hostname") { slot = &v.hostname; present = &v.has_hostname; }
+        else if (key == "os") { slot = &v.os; present = &v.has_os; }
+        else if (key == "ip") slot = &v.ip;
+        else if (key == "timestamp") { slot = &v.timestamp; present = &v.has_timestamp; }
+
+        if (slot) {
+            if (!is_string) {
+                if (why) { *why = "Field '"; *why += std::string(key); *why += "' must be a string"; }
+                return false;
+            }
+            const char* q = json_scan_string(p + 1, end);
+            if (!q) return fail(p, "Invalid string");
+            *slot = std::string_view(p + 1, (size_t)(q - p - 1));
+            if (present) *present = true;
+            p = q + 1;
+        } else if (key == "cpu_cores" || key == "ram_mb") {
+            const bool cores = key == "cpu_cores";
+            if (is_string) {
+                // The agent reports "N/A" when RAM could not be read.
+                const char* q = json_scan_string(p + 1, end);
+                if (!q) return fail(p, "Invalid string");
+                const std::string_view sv(p + 1, (size_t)(q - p - 1));
+                if (cores || sv != "N/A") {
+                    if (why) { *why = "Field '"; *why += std::string(key); *why += "' must be a number"; }
+                    return false;
+                }
+                v.ram_mb = sv;
+                v.ram_mb_num = -1;
+                p = q + 1;
+            } else {
+                long long iv = -1; bool is_int = false;
+                const char* q = json_scan_number(p, end, &iv, &is_int);
+                if (!q || !is_int || iv < 0) {
+                    if (why) { *why = "Field '"; *why += std::string(key); *why += "' must be a non-negative integer"; }
+                    return false;
+                }
+                (cores ? v.cpu_cores : v.ram_mb) = std::string_view(vstart, (size_t)(q - vstart));
+                (cores ? v.cpu_cores_num : v.ram_mb_num) = iv;
+                p = q;
+            }
+        } else {
+            p = json_skip_value(p, end, 1);
+            if (!p) return fail(vstart, "Invalid value");
+        }
+        p = json_skip_ws(p, end);
+    }
+    if (p >= end) return fail(p, "Unterminated object");
+    p = json_skip_ws(p + 1, end);
+    if (p != end) return fail(p, "Trailing data after object");
 
-    std::ostringstream out;
-    out << "{";
-    out << "\"id\":\"" << json_escape(id) << "\",";
-    out << "\"hostname\":\"" << json_escape(hostname) << "\",";
-    out << "\"os\":\"" << json_escape(os) << "\",";
-    out << "\"cpu_cores\":" << cores << ",";
-    if (ram_mb >= 0) out << "\"ram_mb\":" << ram_mb << ",";
-    else out << "\"ram_mb\":\"N/A\",";
-    out << "\"ip\":\"" << json_escape(ip_guess.empty() ? "N/A" : ip_guess) << "\",";
-    out << "\"timestamp\":\"" << json_escape(ts) << "\"";
-    out << "}";
-    return out.str();
+    const char* missing = !v.has_hostname ? "hostname" : !v.has_os ? "os" : !v.has_timestamp ? "timestamp" : nullptr;
+    if (missing) {
+        if (why) { *why = "Missing required key: "; *why += missing; }
+        return false;
+    }
+    return true;
 }
 
 // ------------------------------
 // sockets (client/server) - portable
 // ------------------------------
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
 #if defined(_WIN32)
 static bool winsock_init() {
     WSADATA wsa{};
@@ -195,6 +623,7 @@ static void winsock_cleanup() { WSACleanup(); }
 static int last_sock_err() { return WSAGetLastError(); }
 static int close_socket(int fd) { return closesocket((SOCKET)fd); }
 #else
+typedef int SOCKET; // lets the shared (SOCKET)fd casts compile on POSIX
 static int last_sock_err() { return errno; }
 static int close_socket(int fd) { return close(fd); }
 #endif
@@ -226,7 +655,8 @@ static int set_nonblocking(int fd, bool nb) {
 #endif
 }
 
-static int connect_timeout(const std::string& host, int port, int timeout_ms) {
+// Resolves host:port once; callers that reconnect keep the list instead of paying DNS again.
+static struct addrinfo* resolve_host(const std::string& host, int port) {
     struct addrinfo hints{};
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
@@ -241,9 +671,12 @@ static int connect_timeout(const std::string& host, int port, int timeout_ms) {
 #else
         log_err(std::string("getaddrinfo failed: ") + gai_strerror(gai));
 #endif
-        return -1;
+        return nullptr;
     }
+    return res;
+}
 
+static int connect_resolved(const struct addrinfo* res, int timeout_ms) {
     int sockfd = -1;
     for (auto p = res; p; p = p->ai_next) {
         int s = (int)socket(p->ai_family, p->ai_socktype, p->ai_protocol);
@@ -289,328 +722,6006 @@ static int connect_timeout(const std::string& host, int port, int timeout_ms) {
         }
         close_socket(s);
     }
-
-    freeaddrinfo(res);
     return sockfd;
 }
 
-static bool send_all(int sockfd, const std::string& data) {
-    size_t sent = 0;
-    while (sent < data.size()) {
-        int n = (int)send((SOCKET)sockfd, data.data() + sent, (int)(data.size() - sent), 0);
-        if (n <= 0) return false;
-        sent += (size_t)n;
-    }
-    return true;
+static void set_socket_timeouts(int fd, int timeout_ms) {
+#if defined(_WIN32)
+    DWORD tv = (DWORD)timeout_ms;
+#else
+    struct timeval tv{};
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+#endif
+    setsockopt((SOCKET)fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    setsockopt((SOCKET)fd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof(tv));
 }
 
-static std::string recv_all(int sockfd) {
-    std::string out;
-    char buf[4096];
-    for (;;) {
-        int n = (int)recv((SOCKET)sockfd, buf, (int)sizeof(buf), 0);
-        if (n > 0) out.append(buf, buf + n);
-        else break;
-    }
-    return out;
-}
+// ------------------------------
+// TLS (OpenSSL, built in with `make TLS=1`)
+// ------------------------------
+#if !defined(ASSET_TLS)
+typedef struct ssl_st SSL;                 // never created without OpenSSL: every SSL* stays null
+typedef struct ssl_session_st SSL_SESSION;
+#endif
 
-static int http_post_json(const std::string& host, int port, const std::string& path, const std::string& json_body, int timeout_ms) {
-    int s = connect_timeout(host, port, timeout_ms);
-    if (s < 0) return -1;
+struct TlsOptions {
+    std::string cert, key; // our certificate chain and private key (PEM)
+    std::string ca;        // server: CA that client certificates must chain to (mTLS); client: CA for the server
+};
 
-    std::ostringstream req;
-    req << "POST " << path << " HTTP/1.1\r\n";
-    req << "Host: " << host << ":" << port << "\r\n";
-    req << "Content-Type: application/json\r\n";
-    req << "Content-Length: " << json_body.size() << "\r\n";
-    req << "Connection: close\r\n\r\n";
-    req << json_body;
+#if defined(ASSET_TLS)
+// A handshake is several small writes in a row (Finished, session tickets, then the first
+// request or response); with Nagle each one after the first waits for the peer's delayed ACK.
+static void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt((SOCKET)fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+}
 
-    if (!send_all(s, req.str())) {
-        close_socket(s);
-        return -2;
+static std::string tls_error_text() {
+    std::string out;
+    char buf[256];
+    for (unsigned long e; (e = ERR_get_error()) != 0;) {
+        ERR_error_string_n(e, buf, sizeof(buf));
+        if (!out.empty()) out += "; ";
+        out += buf;
     }
+    return out.empty() ? std::string("unknown TLS error") : out;
+}
+#endif
 
-    std::string resp = recv_all(s);
-    close_socket(s);
+// One SSL_CTX per role, shared by every connection. The server side keeps a session cache and
+// issues session tickets, so an agent that reconnects resumes with an abbreviated handshake
+// instead of a full one; the client side hands each HttpClient its last session back.
+class TlsContext {
+public:
+    TlsContext() = default;
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+    ~TlsContext() {
+#if defined(ASSET_TLS)
+        if (ctx_) SSL_CTX_free(ctx_);
+#endif
+    }
 
-    int code = 0;
-    if (resp.rfind("HTTP/", 0) == 0) {
-        size_t sp = resp.find(' ');
-        if (sp != std::string::npos && sp + 4 < resp.size()) {
-            code = std::atoi(resp.c_str() + sp + 1);
+    bool init_server(const TlsOptions& o, std::string* why) {
+#if defined(ASSET_TLS)
+        if (!init(TLS_server_method(), o, why)) return false;
+        // Sessions outlive an agent's report interval, so its next report resumes.
+        static const unsigned char kSessionContext[] = "asset_inventory";
+        SSL_CTX_set_session_id_context(ctx_, kSessionContext, sizeof(kSessionContext) - 1);
+        SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx_, 20000);
+        SSL_CTX_set_timeout(ctx_, 24 * 3600);
+        if (!o.ca.empty()) {
+            STACK_OF(X509_NAME)* names = SSL_load_client_CA_file(o.ca.c_str());
+            if (!names || SSL_CTX_load_verify_locations(ctx_, o.ca.c_str(), nullptr) != 1) {
+                if (names) sk_X509_NAME_pop_free(names, X509_NAME_free);
+                *why = "cannot load client CA " + o.ca + ": " + tls_error_text();
+                return false;
+            }
+            SSL_CTX_set_client_CA_list(ctx_, names);
+            SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+            mutual_ = true;
         }
+        return true;
+#else
+        (void)o;
+        *why = "built without TLS support (rebuild with make TLS=1)";
+        return false;
+#endif
     }
-    return code;
-}
 
-static std::string http_response(int code, const std::string& content_type, const std::string& body) {
-    std::ostringstream out;
-    out << "HTTP/1.1 " << code << " ";
-    out << (code == 200 ? "OK" : code == 201 ? "Created" : code == 400 ? "Bad Request" : code == 404 ? "Not Found" : "Error");
-    out << "\r\n";
-    out << "Content-Type: " << content_type << "\r\n";
-    out << "Content-Length: " << body.size() << "\r\n";
-    out << "Connection: close\r\n\r\n";
-    out << body;
-    return out.str();
-}
-
-static bool read_until(int sockfd, std::string& data, const std::string& delim, int max_bytes = 1<<20) {
-    char buf[4096];
-    while ((int)data.size() < max_bytes) {
-        if (data.find(delim) != std::string::npos) return true;
-        int n = (int)recv((SOCKET)sockfd, buf, (int)sizeof(buf), 0);
-        if (n <= 0) return false;
-        data.append(buf, buf + n);
+    bool init_client(const TlsOptions& o, std::string* why) {
+#if defined(ASSET_TLS)
+        if (!init(TLS_client_method(), o, why)) return false;
+        const int loaded = o.ca.empty() ? SSL_CTX_set_default_verify_paths(ctx_)
+                                        : SSL_CTX_load_verify_locations(ctx_, o.ca.c_str(), nullptr);
+        if (loaded != 1) {
+            *why = "cannot load CA " + (o.ca.empty() ? std::string("store") : o.ca) + ": " + tls_error_text();
+            return false;
+        }
+        SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+        return true;
+#else
+        (void)o;
+        *why = "built without TLS support (rebuild with make TLS=1)";
+        return false;
+#endif
     }
-    return false;
-}
 
-static void server_loop(int port, const std::string& db_path) {
-#if defined(_WIN32)
-    if (!winsock_init()) {
-        log_err("WSAStartup failed.");
-        return;
-    }
-#endif
+    bool mutual() const { return mutual_; }
 
-    int listen_fd = (int)socket(AF_INET, SOCK_STREAM, 0);
-#if defined(_WIN32)
-    if (listen_fd == (int)INVALID_SOCKET) { log_err("socket() failed."); winsock_cleanup(); return; }
+    // Server: a TLS session for an accepted socket; the caller drives the handshake
+    // (tls_handshake), so a non-blocking socket never stalls its event loop.
+    SSL* accept(int fd) const {
+#if defined(ASSET_TLS)
+        set_nodelay(fd);
+        SSL* s = SSL_new(ctx_);
+        if (!s) return nullptr;
+        if (SSL_set_fd(s, fd) != 1) { SSL_free(s); return nullptr; }
+        SSL_set_accept_state(s);
+        return s;
 #else
-    if (listen_fd < 0) { log_err("socket() failed."); return; }
+        (void)fd;
+        return nullptr;
 #endif
+    }
 
-    int opt = 1;
-    setsockopt((SOCKET)listen_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
-
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons((uint16_t)port);
+    // Client: handshakes over the connected, blocking socket `fd`, checking that the certificate
+    // names `host`, and offers *session (when set) for resumption.
+    SSL* connect(int fd, const std::string& host, SSL_SESSION* session, std::string* why) const {
+#if defined(ASSET_TLS)
+        set_nodelay(fd);
+        SSL* s = SSL_new(ctx_);
+        if (!s || SSL_set_fd(s, fd) != 1) {
+            if (s) SSL_free(s);
+            *why = tls_error_text();
+            return nullptr;
+        }
+        unsigned char addr[16];
+        const bool ip = inet_pton(AF_INET, host.c_str(), addr) == 1 || inet_pton(AF_INET6, host.c_str(), addr) == 1;
+        if (ip) {
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(s), host.c_str());
+        } else {
+            SSL_set_tlsext_host_name(s, host.c_str());
+            SSL_set1_host(s, host.c_str());
+        }
+        if (session) SSL_set_session(s, session);
+        ERR_clear_error();
+        if (SSL_connect(s) != 1) {
+            const long vr = SSL_get_verify_result(s);
+            *why = vr != X509_V_OK ? std::string("certificate verification failed: ") + X509_verify_cert_error_string(vr)
+                                   : tls_error_text();
+            SSL_free(s);
+            return nullptr;
+        }
+        return s;
+#else
+        (void)fd; (void)host; (void)session;
+        *why = "built without TLS support (rebuild with make TLS=1)";
+        return nullptr;
+#endif
+    }
 
-    if (bind((SOCKET)listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
-        int e = last_sock_err();
-        log_err("bind() failed: " + err_text(e));
-        close_socket(listen_fd);
-#if defined(_WIN32)
-        winsock_cleanup();
+private:
+#if defined(ASSET_TLS)
+    bool init(const SSL_METHOD* method, const TlsOptions& o, std::string* why) {
+        ctx_ = SSL_CTX_new(method);
+        if (!ctx_) { *why = tls_error_text(); return false; }
+        SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+        long opts = SSL_OP_NO_RENEGOTIATION;
+#if defined(SSL_OP_IGNORE_UNEXPECTED_EOF)
+        opts |= SSL_OP_IGNORE_UNEXPECTED_EOF; // a peer that just closes the socket reads as EOF, as in plain HTTP
 #endif
-        return;
+        SSL_CTX_set_options(ctx_, opts);
+        // The reactor retries a short write from wherever its buffer is by then.
+        SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+        if (!o.cert.empty() || !o.key.empty()) {
+            if (SSL_CTX_use_certificate_chain_file(ctx_, o.cert.c_str()) != 1 ||
+                SSL_CTX_use_PrivateKey_file(ctx_, (o.key.empty() ? o.cert : o.key).c_str(), SSL_FILETYPE_PEM) != 1 ||
+                SSL_CTX_check_private_key(ctx_) != 1) {
+                *why = "cannot load certificate " + o.cert + " / key " + o.key + ": " + tls_error_text();
+                return false;
+            }
+        }
+        return true;
     }
 
-    if (listen((SOCKET)listen_fd, 16) != 0) {
-        int e = last_sock_err();
-        log_err("listen() failed: " + err_text(e));
-        close_socket(listen_fd);
-#if defined(_WIN32)
-        winsock_cleanup();
+    SSL_CTX* ctx_ = nullptr;
 #endif
-        return;
+    bool mutual_ = false;
+};
+
+// Advances a handshake. Returns 1 once it is done, 0 while it waits for the socket (*want_write
+// says which way), -1 when it failed.
+static int tls_handshake(SSL* tls, bool* want_write) {
+#if defined(ASSET_TLS)
+    ERR_clear_error();
+    const int r = SSL_do_handshake(tls);
+    if (r == 1) return 1;
+    const int e = SSL_get_error(tls, r);
+    if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) {
+        *want_write = e == SSL_ERROR_WANT_WRITE;
+        return 0;
     }
+    if (log_enabled(kLogDebug)) log_debug("TLS handshake failed: " + tls_error_text());
+    ERR_clear_error();
+    return -1;
+#else
+    (void)tls; (void)want_write;
+    return -1;
+#endif
+}
 
-    log_info("Server listening on http://127.0.0.1:" + std::to_string(port) + "/");
-    log_info("DB file: " + db_path);
+static bool tls_resumed(SSL* tls) {
+#if defined(ASSET_TLS)
+    return SSL_session_reused(tls) == 1;
+#else
+    (void)tls;
+    return false;
+#endif
+}
 
-    const std::string html = R"HTML(
-<!doctype html>
-<html>
-<head>
-  <meta charset="utf-8" />
-  <title>Asset Inventory Dashboard</title>
-  <style>
-    body{font-family:system-ui,Segoe UI,Arial;margin:24px}
-    h1{margin:0 0 12px}
-    table{border-collapse:collapse;width:100%}
-    th,td{border:1px solid #ddd;padding:10px;font-size:14px}
-    th{background:#f3f4f6;text-align:left}
-    .muted{color:#6b7280}
-    .row{display:flex;gap:12px;align-items:center;margin:12px 0}
-    a.btn{padding:8px 12px;border:1px solid #ddd;border-radius:10px;text-decoration:none}
-  </style>
-</head>
-<body>
-  <h1>Asset Inventory Dashboard</h1>
-  <div class="row">
-    <span class="muted">Refresh: otomatis setiap 3 detik</span>
-    <a class="btn" href="/api/export.csv">Export CSV</a>
-  </div>
-  <table>
-    <thead>
-      <tr><th>ID</th><th>Hostname</th><th>OS</th><th>Cores</th><th>RAM (MB)</th><th>IP</th><th>Timestamp</th></tr>
-    </thead>
-    <tbody id="tb"></tbody>
-  </table>
+// Decrypted bytes SSL_read() has not handed out yet; epoll cannot see them.
+static bool tls_buffered(SSL* tls) {
+#if defined(ASSET_TLS)
+    return tls && SSL_pending(tls) > 0;
+#else
+    (void)tls;
+    return false;
+#endif
+}
 
-<script>
-async function load(){
-  const r = await fetch('/api/assets');
-  const data = await r.json();
-  const tb = document.getElementById('tb');
-  tb.innerHTML='';
-  for (const it of data){
-    const tr=document.createElement('tr');
-    tr.innerHTML = `<td>${it.id||''}</td><td>${it.hostname||''}</td><td>${it.os||''}</td><td>${it.cpu_cores||''}</td><td>${it.ram_mb||''}</td><td>${it.ip||''}</td><td>${it.timestamp||''}</td>`;
-    tb.appendChild(tr);
-  }
+// Sends close_notify (best effort, the socket may be non-blocking) and frees the session.
+static void tls_close(SSL* tls) {
+#if defined(ASSET_TLS)
+    if (!tls) return;
+    ERR_clear_error();
+    SSL_shutdown(tls);
+    ERR_clear_error();
+    SSL_free(tls);
+#else
+    (void)tls;
+#endif
 }
-load();
-setInterval(load, 3000);
-</script>
-</body>
-</html>
-)HTML";
 
-    for (;;) {
-        sockaddr_in client{};
-#if defined(_WIN32)
-        int clen = sizeof(client);
+// Keeps the session of a finished client connection in *session when it can be resumed (with
+// TLS 1.3 that needs a ticket, which arrives with the first response).
+static void tls_keep_session(SSL* tls, SSL_SESSION** session) {
+#if defined(ASSET_TLS)
+    SSL_SESSION* now = SSL_get1_session(tls);
+    if (!now) return;
+    if (!SSL_SESSION_is_resumable(now)) { SSL_SESSION_free(now); return; }
+    if (*session) SSL_SESSION_free(*session);
+    *session = now;
 #else
-        socklen_t clen = sizeof(client);
+    (void)tls; (void)session;
 #endif
-        int cfd = (int)accept((SOCKET)listen_fd, (sockaddr*)&client, &clen);
-#if defined(_WIN32)
-        if (cfd == (int)INVALID_SOCKET) continue;
+}
+
+static void tls_free_session(SSL_SESSION* session) {
+#if defined(ASSET_TLS)
+    if (session) SSL_SESSION_free(session);
 #else
-        if (cfd < 0) continue;
+    (void)session;
+#endif
+}
+
+// recv()/send() over a plain socket, or over `tls` when it is set. A TLS session that needs
+// the socket to become ready again reports -1 with errno EAGAIN, like a non-blocking socket.
+static int sock_recv(int fd, SSL* tls, char* buf, size_t n) {
+#if defined(ASSET_TLS)
+    if (tls) {
+        ERR_clear_error();
+        const int r = SSL_read(tls, buf, (int)std::min<size_t>(n, INT_MAX));
+        if (r > 0) return r;
+        const int e = SSL_get_error(tls, r);
+        if (e == SSL_ERROR_ZERO_RETURN) return 0;
+        errno = e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE ? EAGAIN : ECONNRESET;
+        ERR_clear_error();
+        return -1;
+    }
 #endif
+    (void)tls;
+    return (int)recv((SOCKET)fd, buf, (int)n, 0);
+}
 
-        std::string data;
-        if (!read_until(cfd, data, "\r\n\r\n")) { close_socket(cfd); continue; }
+static int sock_send(int fd, SSL* tls, const char* buf, size_t n) {
+#if defined(ASSET_TLS)
+    if (tls) {
+        ERR_clear_error();
+        const int r = SSL_write(tls, buf, (int)std::min<size_t>(n, INT_MAX));
+        if (r > 0) return r;
+        const int e = SSL_get_error(tls, r);
+        errno = e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE ? EAGAIN : EPIPE;
+        ERR_clear_error();
+        return -1;
+    }
+#endif
+    (void)tls;
+    return (int)send((SOCKET)fd, buf, (int)n, MSG_NOSIGNAL);
+}
 
-        size_t line_end = data.find("\r\n");
-        std::string req_line = line_end == std::string::npos ? data : data.substr(0, line_end);
-        std::istringstream rl(req_line);
-        std::string method, path, ver;
-        rl >> method >> path >> ver;
+static bool send_all(int sockfd, const std::string& data, SSL* tls = nullptr) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = sock_send(sockfd, tls, data.data() + sent, data.size() - sent);
+        if (n <= 0) return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
 
-        size_t hdr_end = data.find("\r\n\r\n");
-        std::string headers = data.substr(0, hdr_end);
-        std::string body = data.substr(hdr_end + 4);
+// Decimal digits only, no sign or spaces; at most `max`.
+static bool parse_uint(std::string_view s, unsigned long long max, unsigned long long* out) {
+    if (s.empty() || s.size() > 19) return false;
+    unsigned long long v = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+        v = v * 10 + (unsigned)(c - '0');
+    }
+    if (v > max) return false;
+    *out = v;
+    return true;
+}
 
-        long long content_len = 0;
-        {
-            std::istringstream hs(headers);
-            std::string hline;
-            while (std::getline(hs, hline)) {
-                if (!hline.empty() && hline.back() == '\r') hline.pop_back();
-                std::string lower = hline;
-                for (char& ch : lower) ch = (char)std::tolower((unsigned char)ch);
-                if (lower.rfind("content-length:", 0) == 0) {
-                    content_len = std::atoll(hline.c_str() + std::string("Content-Length:").size());
-                }
+// Case-insensitive lookup of one header in a raw header block ("Name: value" lines), from
+// offset *pos on; *pos is left after the line found, so repeated calls see every occurrence.
+static bool header_next(std::string_view headers, const char* name, size_t* pos_io, std::string_view& out) {
+    const size_t nlen = std::strlen(name);
+    size_t& pos = *pos_io;
+    while (pos < headers.size()) {
+        size_t eol = headers.find("\r\n", pos);
+        if (eol == std::string_view::npos) eol = headers.size();
+        if (eol - pos > nlen && headers[pos + nlen] == ':') {
+            bool match = true;
+            for (size_t i = 0; i < nlen && match; i++) {
+                match = std::tolower((unsigned char)headers[pos + i]) == std::tolower((unsigned char)name[i]);
+            }
+            if (match) {
+                size_t v = pos + nlen + 1;
+                while (v < eol && (headers[v] == ' ' || headers[v] == '\t')) v++;
+                size_t e = eol;
+                while (e > v && (headers[e-1] == ' ' || headers[e-1] == '\t')) e--;
+                out = headers.substr(v, e - v);
+                pos = eol + 2;
+                return true;
             }
         }
-        while ((long long)body.size() < content_len) {
-            char buf[4096];
-            int n = (int)recv((SOCKET)cfd, buf, (int)sizeof(buf), 0);
-            if (n <= 0) break;
-            body.append(buf, buf + n);
-        }
+        pos = eol + 2;
+    }
+    return false;
+}
+
+static bool header_value(std::string_view headers, const char* name, std::string_view& out) {
+    size_t pos = 0;
+    return header_next(headers, name, &pos, out);
+}
+
+static bool iequals(std::string_view a, const char* b) {
+    size_t n = std::strlen(b);
+    if (a.size() != n) return false;
+    for (size_t i = 0; i < n; i++) {
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+// ------------------------------
+// agent collectors (probe registry)
+// ------------------------------
+// One probe fills one top-level field of the report with a ready JSON value, or "" to leave the
+// field out. A probe with `timeout` 0 runs inline (the required fields); the others run in
+// parallel, each on its own thread, and are abandoned after `timeout`, in which case their last
+// good value is reported. A result younger than `ttl` is reused without running the probe.
+struct Probe {
+    std::string field;
+    std::function<std::string()> run;
+    std::chrono::milliseconds timeout{0};
+    std::chrono::seconds ttl{0};
+};
+
+class CollectorRegistry {
+public:
+    void add(Probe p) { slots_.push_back(Slot{std::move(p), std::make_shared<State>()}); }
+
+    // Only optional (timed) probes can be dropped; the required fields always stay.
+    bool remove_optional(const std::string& field) {
+        for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+            if (it->probe.field == field && it->probe.timeout.count() > 0) { slots_.erase(it); return true; }
+        }
+        return false;
+    }
+
+    // Appends ,"field":value for every probe that has something to report, in registration order.
+    void collect(std::string& out) {
+        const auto start = std::chrono::steady_clock::now();
+        for (auto& s : slots_) {
+            if (s.probe.timeout.count() == 0) continue;
+            std::lock_guard<std::mutex> lk(s.state->mu);
+            // A probe still stuck from an earlier pass is not started twice.
+            if (s.state->running || (s.state->fetched && start - s.state->at < s.probe.ttl)) continue;
+            s.state->running = true;
+            std::thread([st = s.state, run = s.probe.run] {
+                std::string v = run_probe(run);
+                std::lock_guard<std::mutex> lk(st->mu);
+                st->value = std::move(v);
+                st->fetched = true;
+                st->at = std::chrono::steady_clock::now();
+                st->running = false;
+                st->cv.notify_all();
+            }).detach();
+        }
+        for (auto& s : slots_) {
+            std::string value;
+            if (s.probe.timeout.count() == 0) {
+                value = run_probe(s.probe.run);
+            } else {
+                std::unique_lock<std::mutex> lk(s.state->mu);
+                if (!s.state->cv.wait_until(lk, start + s.probe.timeout, [&] { return !s.state->running; })) {
+                    log_warn("Probe '" + s.probe.field + "' timed out" + (s.state->fetched ? "; reporting its last value" : ""));
+                }
+                value = s.state->value;
+            }
+            if (value.empty()) continue;
+            out += ",\""; out += s.probe.field; out += "\":"; out += value;
+        }
+    }
+
+private:
+    struct State {
+        std::mutex mu;
+        std::condition_variable cv;
+        bool running = false;
+        bool fetched = false;
+        std::chrono::steady_clock::time_point at;
+        std::string value;
+    };
+    struct Slot {
+        Probe probe;
+        std::shared_ptr<State> state; // shared with a probe thread that may outlive the pass
+    };
+
+    static std::string run_probe(const std::function<std::string()>& run) {
+        try { return run(); } catch (...) { return std::string(); }
+    }
+
+    std::vector<Slot> slots_;
+};
+
+static std::string json_str(const std::string& s) { return "\"" + json_escape(s) + "\""; }
+
+static std::string sockaddr_ip(const struct sockaddr* sa) {
+    char buf[INET6_ADDRSTRLEN] = {0};
+    if (sa->sa_family == AF_INET) inet_ntop(AF_INET, (void*)&((const struct sockaddr_in*)sa)->sin_addr, buf, sizeof(buf));
+    else if (sa->sa_family == AF_INET6) inet_ntop(AF_INET6, (void*)&((const struct sockaddr_in6*)sa)->sin6_addr, buf, sizeof(buf));
+    return buf;
+}
+
+// First non-loopback IPv4 address of any interface that is up.
+static std::string first_interface_ip() {
+#if defined(_WIN32)
+    return std::string();
+#else
+    struct ifaddrs* ifs = nullptr;
+    if (getifaddrs(&ifs) != 0) return std::string();
+    std::string ip;
+    for (auto p = ifs; p && ip.empty(); p = p->ifa_next) {
+        if (!p->ifa_addr || p->ifa_addr->sa_family != AF_INET) continue;
+        if ((p->ifa_flags & IFF_LOOPBACK) || !(p->ifa_flags & IFF_UP)) continue;
+        ip = sockaddr_ip(p->ifa_addr);
+    }
+    freeifaddrs(ifs);
+    return ip;
+#endif
+}
+
+// The local address the kernel would use to reach the server: connecting a UDP socket picks
+// the route without sending anything. Falls back to an interface address when that is loopback.
+static std::string detect_route_ip(const std::string& host, int port) {
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* res = nullptr;
+    std::string ip;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) == 0 && res) {
+        for (auto p = res; p && ip.empty(); p = p->ai_next) {
+            int s = (int)socket(p->ai_family, SOCK_DGRAM, 0);
+            if (s < 0) continue;
+            struct sockaddr_storage local{};
+            socklen_t len = sizeof(local);
+            if (connect((SOCKET)s, p->ai_addr, (int)p->ai_addrlen) == 0 &&
+                getsockname((SOCKET)s, (struct sockaddr*)&local, &len) == 0) {
+                ip = sockaddr_ip((const struct sockaddr*)&local);
+            }
+            close_socket(s);
+        }
+        freeaddrinfo(res);
+    }
+    if (ip.empty() || ip.rfind("127.", 0) == 0 || ip == "::1") {
+        const std::string nic = first_interface_ip();
+        if (!nic.empty()) ip = nic;
+    }
+    return ip.empty() ? "N/A" : ip;
+}
+
+static std::string probe_kernel() {
+#if defined(_WIN32)
+    return std::string();
+#else
+    struct utsname u{};
+    if (uname(&u) != 0) return std::string();
+    return json_str(std::string(u.sysname) + " " + u.release);
+#endif
+}
+
+static std::string probe_cpu_model() {
+#if defined(_WIN32)
+    char buf[256] = {0};
+    DWORD sz = (DWORD)sizeof(buf);
+    if (RegGetValueA(HKEY_LOCAL_MACHINE, "HARDWARE\\DESCRIPTION\\System\\CentralProcessor\\0", "ProcessorNameString",
+                     RRF_RT_REG_SZ, nullptr, buf, &sz) == ERROR_SUCCESS) return json_str(buf);
+    return std::string();
+#elif defined(__APPLE__)
+    char buf[256] = {0};
+    size_t len = sizeof(buf) - 1;
+    if (sysctlbyname("machdep.cpu.brand_string", buf, &len, nullptr, 0) == 0) return json_str(buf);
+    return std::string();
+#else
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        // x86 has "model name"; many ARM kernels only have "Hardware" or "Processor".
+        if (line.rfind("model name", 0) == 0 || line.rfind("Hardware", 0) == 0 || line.rfind("Processor", 0) == 0) {
+            const size_t colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            std::string v = line.substr(colon + 1);
+            v.erase(0, v.find_first_not_of(" \t"));
+            if (!v.empty()) return json_str(v);
+        }
+    }
+    return std::string();
+#endif
+}
+
+// Boot time as epoch seconds. Unlike an uptime it stays put between reports, so an idle host
+// keeps the same record hash.
+static std::string probe_boot_time() {
+#if defined(_WIN32)
+    const long long boot = (long long)std::time(nullptr) - (long long)(GetTickCount64() / 1000);
+    return std::to_string(boot - boot % 60); // derived from the tick count: round off the drift
+#elif defined(__linux__)
+    std::ifstream in("/proc/stat");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind("btime ", 0) == 0) return line.substr(6);
+    }
+    return std::string();
+#elif defined(__APPLE__)
+    struct timeval boot{};
+    size_t len = sizeof(boot);
+    int mib[2] = {CTL_KERN, KERN_BOOTTIME};
+    if (sysctl(mib, 2, &boot, &len, nullptr, 0) != 0) return std::string();
+    return std::to_string((long long)boot.tv_sec);
+#else
+    return std::string();
+#endif
+}
+
+// [{"mount":"/","fs":"ext4","total_mb":n,"free_mb":n},...] for local block-device filesystems.
+// free_mb is rounded down to 0.1% of the size, so ordinary churn does not change the report.
+static std::string probe_disks() {
+    std::string out;
+    auto add = [&](const std::string& mount, const std::string& fs, unsigned long long total, unsigned long long avail) {
+        const unsigned long long step = std::max(1ull, (total >> 20) / 1000);
+        out += out.empty() ? "[" : ",";
+        out += "{\"mount\":"; out += json_str(mount);
+        if (!fs.empty()) { out += ",\"fs\":"; out += json_str(fs); }
+        out += ",\"total_mb\":"; out += std::to_string(total >> 20);
+        out += ",\"free_mb\":"; out += std::to_string((avail >> 20) / step * step); out += '}';
+    };
+#if defined(_WIN32)
+    char drives[256] = {0};
+    const DWORD n = GetLogicalDriveStringsA((DWORD)sizeof(drives) - 1, drives);
+    for (const char* d = drives; n && n < sizeof(drives) && *d; d += std::strlen(d) + 1) {
+        if (GetDriveTypeA(d) != DRIVE_FIXED) continue;
+        ULARGE_INTEGER avail{}, total{};
+        if (GetDiskFreeSpaceExA(d, &avail, &total, nullptr)) add(d, "", total.QuadPart, avail.QuadPart);
+    }
+#elif defined(__linux__)
+    std::ifstream in("/proc/mounts");
+    std::string dev, mount, fs, rest;
+    std::set<std::string> seen;
+    while (in >> dev >> mount >> fs && std::getline(in, rest)) {
+        if (dev.rfind("/dev/", 0) != 0 || fs == "squashfs" || !seen.insert(dev).second) continue;
+        // /proc/mounts escapes spaces and tabs as \040 and \011.
+        std::string m;
+        for (size_t i = 0; i < mount.size(); i++) {
+            if (mount[i] == '\\' && i + 3 < mount.size()) { m += (char)std::strtol(mount.substr(i + 1, 3).c_str(), nullptr, 8); i += 3; }
+            else m += mount[i];
+        }
+        struct statvfs st{};
+        if (statvfs(m.c_str(), &st) == 0) add(m, fs, (unsigned long long)st.f_blocks * st.f_frsize, (unsigned long long)st.f_bavail * st.f_frsize);
+    }
+#else
+    struct statvfs st{};
+    if (statvfs("/", &st) == 0) add("/", "", (unsigned long long)st.f_blocks * st.f_frsize, (unsigned long long)st.f_bavail * st.f_frsize);
+#endif
+    return out.empty() ? out : out + "]";
+}
+
+// [{"name":"eth0","addrs":["10.0.0.5","fe80::1"]},...] for non-loopback interfaces.
+static std::string probe_nics() {
+#if defined(_WIN32)
+    return std::string(); // would need iphlpapi
+#else
+    struct ifaddrs* ifs = nullptr;
+    if (getifaddrs(&ifs) != 0) return std::string();
+    std::vector<std::pair<std::string, std::vector<std::string>>> nics;
+    for (auto p = ifs; p; p = p->ifa_next) {
+        if (!p->ifa_addr || (p->ifa_flags & IFF_LOOPBACK)) continue;
+        if (p->ifa_addr->sa_family != AF_INET && p->ifa_addr->sa_family != AF_INET6) continue;
+        auto it = std::find_if(nics.begin(), nics.end(), [&](const auto& n) { return n.first == p->ifa_name; });
+        if (it == nics.end()) it = nics.insert(nics.end(), {p->ifa_name, {}});
+        it->second.push_back(sockaddr_ip(p->ifa_addr));
+    }
+    freeifaddrs(ifs);
+    if (nics.empty()) return std::string();
+    std::string out = "[";
+    for (size_t i = 0; i < nics.size(); i++) {
+        if (i) out += ',';
+        out += "{\"name\":"; out += json_str(nics[i].first); out += ",\"addrs\":[";
+        for (size_t k = 0; k < nics[i].second.size(); k++) { if (k) out += ','; out += json_str(nics[i].second[k]); }
+        out += "]}";
+    }
+    return out + "]";
+#endif
+}
+
+// {"manager":"dpkg","count":n,"digest":"..."}: the digest covers every name=version, so the
+// server can tell when the set changed without receiving the whole list.
+static std::string probe_packages() {
+#if defined(__linux__)
+    std::vector<std::string> pkgs;
+    std::string manager;
+    if (std::ifstream in{"/var/lib/dpkg/status"}) {
+        manager = "dpkg";
+        std::string line, name, version;
+        bool installed = false;
+        auto flush = [&] {
+            if (installed && !name.empty()) pkgs.push_back(name + "=" + version);
+            name.clear(); version.clear(); installed = false;
+        };
+        while (std::getline(in, line)) {
+            if (line.empty()) flush();
+            else if (line.rfind("Package: ", 0) == 0) name = line.substr(9);
+            else if (line.rfind("Version: ", 0) == 0) version = line.substr(9);
+            else if (line.rfind("Status: ", 0) == 0) installed = line.find(" installed") != std::string::npos;
+        }
+        flush();
+    } else if (std::ifstream apk{"/lib/apk/db/installed"}) {
+        manager = "apk";
+        std::string line, name;
+        while (std::getline(apk, line)) {
+            if (line.rfind("P:", 0) == 0) name = line.substr(2);
+            else if (line.rfind("V:", 0) == 0) pkgs.push_back(name + "=" + line.substr(2));
+        }
+    } else if (std::FILE* p = popen("rpm -qa --qf '%{NAME}=%{VERSION}-%{RELEASE}\\n' 2>/dev/null", "r")) {
+        char buf[512];
+        while (std::fgets(buf, sizeof(buf), p)) {
+            std::string s(buf);
+            while (!s.empty() && (s.back() == '\n' || s.back() == '\r')) s.pop_back();
+            if (!s.empty()) pkgs.push_back(s);
+        }
+        if (pclose(p) == 0 && !pkgs.empty()) manager = "rpm";
+    }
+    if (manager.empty()) return std::string();
+    std::sort(pkgs.begin(), pkgs.end());
+    uint64_t h = kFnvOffset;
+    for (const auto& s : pkgs) h = fnv1a64(fnv1a64(h, s), "\n");
+    char digest[17];
+    std::snprintf(digest, sizeof(digest), "%016llx", (unsigned long long)h);
+    return "{\"manager\":\"" + manager + "\",\"count\":" + std::to_string(pkgs.size()) + ",\"digest\":\"" + digest + "\"}";
+#else
+    return std::string();
+#endif
+}
+
+// The report's fields in order. The first ones are required by the server and run inline;
+// `ip` is taken as given, or detected from the route to the server.
+static void register_agent_probes(CollectorRegistry& r, const std::string& ip, const std::string& server_host, int server_port,
+                                  std::chrono::milliseconds timeout) {
+    using std::chrono::seconds;
+    r.add({"hostname", [] { return json_str(get_hostname()); }});
+    r.add({"os", [] { return json_str(get_os_name()); }});
+    r.add({"cpu_cores", [] { return std::to_string(get_cpu_cores()); }});
+    r.add({"ram_mb", [] { const long long mb = get_total_ram_mb(); return mb >= 0 ? std::to_string(mb) : std::string("\"N/A\""); }});
+    r.add({"ip", [ip, server_host, server_port] { return json_str(!ip.empty() ? ip : detect_route_ip(server_host, server_port)); }});
+    r.add({"timestamp", [] { return json_str(now_iso8601_local()); }});
+    r.add({"kernel", probe_kernel, timeout, seconds(3600)});
+    r.add({"cpu_model", probe_cpu_model, timeout, seconds(24 * 3600)});
+    r.add({"boot_time", probe_boot_time, timeout, seconds(3600)});
+    r.add({"disks", probe_disks, timeout, seconds(0)});
+    r.add({"nics", probe_nics, timeout, seconds(60)});
+    r.add({"packages", probe_packages, timeout, seconds(6 * 3600)});
+}
+
+// --skip-probes a,b: drops optional probes by field name.
+static void skip_agent_probes(CollectorRegistry& r, const std::string& csv) {
+    std::istringstream in(csv);
+    std::string name;
+    while (std::getline(in, name, ',')) {
+        if (!name.empty() && !r.remove_optional(name)) log_warn("Cannot skip probe '" + name + "' (unknown or required)");
+    }
+}
+
+static std::string build_asset_json(CollectorRegistry& probes, const std::string& id) {
+    std::string out = "{\"id\":" + json_str(id);
+    probes.collect(out);
+    out += '}';
+    return out;
+}
+
+// ------------------------------
+// HTTP/1.1 client with connection reuse (agent side)
+// ------------------------------
+class HttpClient {
+public:
+    // With `tls`, every connection is HTTPS; the last session is offered again on reconnect.
+    HttpClient(const std::string& host, int port, int timeout_ms, const TlsContext* tls = nullptr)
+        : host_(host), port_(port), timeout_ms_(timeout_ms), tls_(tls) {}
+    ~HttpClient() {
+        disconnect();
+        tls_free_session(session_);
+        if (res_) freeaddrinfo(res_);
+    }
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    // Sends one request over the kept-alive connection and waits for its response.
+    // Returns the HTTP status, -1 when connecting failed, -2 when sending failed, -3 on a broken response.
+    int request(const std::string& method, const std::string& path, const std::string& body, std::string* resp_body = nullptr) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            const bool reused = fd_ >= 0;
+            if (!ensure_connected()) return -1;
+            if (!send_all(fd_, build_request(method, path, body), ssl_)) {
+                disconnect();
+                if (reused) continue; // server dropped the idle connection; retry once on a fresh one
+                return -2;
+            }
+            bool got_bytes = false;
+            int code = read_response(resp_body, &got_bytes);
+            if (code < 0 && reused && !got_bytes) continue;
+            return code;
+        }
+        return -3;
+    }
+
+    // Pipelines POSTs: each window of requests is written back-to-back, then the responses are read in order.
+    // Entries that never got an answer (connection lost mid-window) are reported as negative codes.
+    std::vector<int> post_pipelined(const std::string& path, const std::vector<std::string>& bodies, size_t window = 64) {
+        std::vector<int> codes(bodies.size(), -3);
+        size_t next = 0;
+        while (next < bodies.size()) {
+            if (!ensure_connected()) {
+                for (size_t i = next; i < bodies.size(); i++) codes[i] = -1;
+                break;
+            }
+            const size_t end = std::min(bodies.size(), next + window);
+            std::string batch;
+            for (size_t i = next; i < end; i++) batch += build_request("POST", path, bodies[i]);
+            if (!send_all(fd_, batch, ssl_)) {
+                disconnect();
+                for (size_t i = next; i < end; i++) codes[i] = -2;
+                next = end;
+                continue;
+            }
+            for (size_t i = next; i < end; i++) {
+                codes[i] = read_response(nullptr, nullptr);
+                if (codes[i] < 0) break;
+            }
+            next = end;
+        }
+        return codes;
+    }
+
+    // Sends the bodies `per_request` at a time as NDJSON to a batch endpoint and returns one code
+    // per body: the per-record status from the reply, or the request's own code when it failed.
+    std::vector<int> post_batched(const std::string& path, const std::vector<std::string>& bodies, size_t per_request) {
+        std::vector<int> codes(bodies.size(), -3);
+        std::string payload, resp;
+        for (size_t next = 0; next < bodies.size(); ) {
+            const size_t end = std::min(bodies.size(), next + per_request);
+            payload.clear();
+            for (size_t i = next; i < end; i++) { payload += bodies[i]; payload += '\n'; }
+            const int code = request("POST", path, payload, &resp);
+            size_t i = next, at = 0;
+            if (code == 200 || code == 400) {
+                static const char kStatus[] = "\"status\":";
+                while (i < end && (at = resp.find(kStatus, at)) != std::string::npos) {
+                    at += sizeof(kStatus) - 1;
+                    codes[i++] = std::atoi(resp.c_str() + at);
+                }
+            }
+            if (i != end) for (i = next; i < end; i++) codes[i] = code; // no usable per-record list
+            next = end;
+        }
+        return codes;
+    }
+
+    void disconnect() {
+        if (ssl_) {
+            tls_keep_session(ssl_, &session_);
+            tls_close(ssl_);
+            ssl_ = nullptr;
+        }
+        if (fd_ >= 0) close_socket(fd_);
+        fd_ = -1;
+        buf_.clear();
+    }
+
+    // TLS handshakes made so far, and how many of them resumed an earlier session.
+    size_t tls_handshakes() const { return handshakes_; }
+    size_t tls_resumptions() const { return resumed_; }
+
+private:
+    bool ensure_connected() {
+        if (fd_ >= 0) return true;
+        if (!res_) res_ = resolve_host(host_, port_);
+        if (!res_) return false;
+        fd_ = connect_resolved(res_, timeout_ms_);
+        if (fd_ < 0) return false;
+        set_socket_timeouts(fd_, timeout_ms_);
+        if (tls_) {
+            std::string why;
+            ssl_ = tls_->connect(fd_, host_, session_, &why);
+            if (!ssl_) {
+                log_warn("TLS handshake with " + host_ + ":" + std::to_string(port_) + " failed: " + why);
+                close_socket(fd_);
+                fd_ = -1;
+                return false;
+            }
+            handshakes_++;
+            if (tls_resumed(ssl_)) resumed_++;
+        }
+        return true;
+    }
+
+    std::string build_request(const std::string& method, const std::string& path, const std::string& body) const {
+        std::string req;
+        req.reserve(128 + path.size() + host_.size() + body.size());
+        req += method; req += ' '; req += path; req += " HTTP/1.1\r\n";
+        req += "Host: "; req += host_; req += ':'; req += std::to_string(port_); req += "\r\n";
+        if (!body.empty() || method == "POST") {
+            req += "Content-Type: application/json\r\n";
+            req += "Content-Length: "; req += std::to_string(body.size()); req += "\r\n";
+        }
+        req += "Connection: keep-alive\r\n\r\n";
+        req += body;
+        return req;
+    }
+
+    bool fill() {
+        char buf[16384];
+        int n = sock_recv(fd_, ssl_, buf, sizeof(buf));
+        if (n <= 0) return false;
+        buf_.append(buf, buf + n);
+        return true;
+    }
+
+    int read_response(std::string* body, bool* got_bytes) {
+        size_t hdr_end;
+        while ((hdr_end = buf_.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) { disconnect(); return -3; }
+            if (got_bytes) *got_bytes = true;
+        }
+        if (got_bytes) *got_bytes = true;
+
+        int code = 0;
+        if (buf_.rfind("HTTP/", 0) == 0) {
+            size_t sp = buf_.find(' ');
+            if (sp != std::string::npos && sp < hdr_end) code = std::atoi(buf_.c_str() + sp + 1);
+        }
+        const std::string_view headers(buf_.data(), hdr_end);
+        std::string_view v;
+        const bool server_closes = header_value(headers, "Connection", v) && iequals(v, "close");
+        const bool chunked = header_value(headers, "Transfer-Encoding", v) && iequals(v, "chunked");
+        long long content_len = -1;
+        unsigned long long n;
+        if (header_value(headers, "Content-Length", v) && parse_uint(v, LLONG_MAX, &n)) content_len = (long long)n;
+        if (code == 304 || code == 204) content_len = 0; // never carry a body
+
+        size_t pos = hdr_end + 4;
+        std::string out;
+        if (chunked) {
+            for (;;) {
+                size_t eol;
+                while ((eol = buf_.find("\r\n", pos)) == std::string::npos) {
+                    if (!fill()) { disconnect(); return -3; }
+                }
+                const size_t len = (size_t)std::strtoull(buf_.c_str() + pos, nullptr, 16);
+                pos = eol + 2;
+                while (buf_.size() < pos + len + 2) {
+                    if (!fill()) { disconnect(); return -3; }
+                }
+                if (body) out.append(buf_, pos, len);
+                pos += len + 2;
+                if (len == 0) break; // no trailers are ever sent by our server
+            }
+        } else if (content_len >= 0) {
+            while (buf_.size() < pos + (size_t)content_len) {
+                if (!fill()) { disconnect(); return -3; }
+            }
+            if (body) out.assign(buf_, pos, (size_t)content_len);
+            pos += (size_t)content_len;
+        } else {
+            while (fill()) {}
+            if (body) out.assign(buf_, pos, std::string::npos);
+            pos = buf_.size();
+        }
+
+        buf_.erase(0, pos);
+        if (body) *body = std::move(out);
+        if (server_closes || (content_len < 0 && !chunked)) disconnect();
+        return code;
+    }
+
+    std::string host_;
+    int port_;
+    int timeout_ms_;
+    int fd_ = -1;
+    struct addrinfo* res_ = nullptr;
+    std::string buf_; // bytes received past the current response (pipelined replies)
+    const TlsContext* tls_;
+    SSL* ssl_ = nullptr;
+    SSL_SESSION* session_ = nullptr; // from the last connection, offered to the next one
+    size_t handshakes_ = 0, resumed_ = 0;
+};
+
+static const char* http_status_text(int code) {
+    return code == 200 ? "OK" : code == 201 ? "Created" : code == 304 ? "Not Modified" : code == 400 ? "Bad Request" : code == 404 ? "Not Found"
+         : code == 408 ? "Request Timeout" : code == 409 ? "Conflict" : code == 413 ? "Content Too Large"
+         : code == 429 ? "Too Many Requests" : code == 431 ? "Request Header Fields Too Large"
+         : code == 500 ? "Internal Server Error" : code == 501 ? "Not Implemented" : code == 503 ? "Service Unavailable" : "Error";
+}
+
+static const size_t kHttpHeadBytes = 160; // a head without content type and extra lines fits in this
+
+// Appends the status line + headers to `out`. content_length < 0 means the body is streamed
+// (chunked, or until close). `extra` holds additional complete header lines ("Name: value\r\n").
+static void http_head_into(std::string& out, int code, std::string_view content_type, long long content_length,
+                           bool keep_alive, bool chunked, std::string_view extra) {
+    char num[24];
+    out += "HTTP/1.1 ";
+    out.append(num, (size_t)(std::to_chars(num, num + sizeof(num), code).ptr - num));
+    out += ' '; out += http_status_text(code); out += "\r\n";
+    out += "Content-Type: "; out += content_type; out += "\r\n";
+    out += extra;
+    if (chunked) out += "Transfer-Encoding: chunked\r\n";
+    else if (content_length >= 0) {
+        out += "Content-Length: ";
+        out.append(num, (size_t)(std::to_chars(num, num + sizeof(num), content_length).ptr - num));
+        out += "\r\n";
+    }
+    out += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+}
+
+static std::string http_head(int code, std::string_view content_type, long long content_length, bool keep_alive,
+                             bool chunked = false, std::string_view extra = std::string_view()) {
+    std::string out;
+    out.reserve(kHttpHeadBytes + content_type.size() + extra.size());
+    http_head_into(out, code, content_type, content_length, keep_alive, chunked, extra);
+    return out;
+}
+
+// Head and body in one buffer, sized up front so building it is a single allocation.
+static std::string http_response(int code, std::string_view content_type, std::string_view body, bool keep_alive = false,
+                                 std::string_view extra = std::string_view()) {
+    std::string out;
+    out.reserve(kHttpHeadBytes + content_type.size() + extra.size() + body.size());
+    http_head_into(out, code, content_type, (long long)body.size(), keep_alive, false, extra);
+    out += body;
+    return out;
+}
+
+// Produces a response body incrementally so a large body never sits in memory at once.
+struct BodyStream {
+    virtual ~BodyStream() = default;
+    // Appends about `budget` bytes of body to `out`; returns false once the body is complete.
+    virtual bool next(std::string& out, size_t budget) = 0;
+};
+
+struct HttpResponse {
+    std::string wire;                   // full response, or only the head when `stream` is set
+    std::shared_ptr<const std::string> shared; // full response shared with the cache, sent in place of `wire`
+    std::unique_ptr<BodyStream> stream;
+    bool chunked = false;               // frame stream pieces as HTTP/1.1 chunks
+    bool close = false;                 // body ends when the connection closes (HTTP/1.0 clients)
+
+    HttpResponse() = default;
+    HttpResponse(std::string w) : wire(std::move(w)) {}
+    HttpResponse(std::shared_ptr<const std::string> s) : shared(std::move(s)) {}
+    bool empty() const { return wire.empty() && !shared && !stream; }
+    const std::string& head() const { return shared ? *shared : wire; } // starts with the status line
+};
+
+// A fixed reply, framed once for each connection mode; answering with it copies a pointer.
+struct CannedResponse {
+    std::shared_ptr<const std::string> keep_alive, close;
+
+    CannedResponse(int code, const char* content_type, const char* body)
+        : keep_alive(std::make_shared<const std::string>(http_response(code, content_type, body, true))),
+          close(std::make_shared<const std::string>(http_response(code, content_type, body, false))) {}
+};
+
+static const CannedResponse kAckCreated(201, "application/json; charset=utf-8", "{\"ok\":true}");
+
+// Pulls the next piece of a streamed body and frames it. Returns false when the body is done
+// (the terminating chunk has been appended).
+static bool http_stream_piece(HttpResponse& r, std::string& out, size_t budget) {
+    std::string piece;
+    piece.reserve(budget + 1024);
+    const bool more = r.stream->next(piece, budget);
+    if (!piece.empty()) {
+        if (r.chunked) {
+            char hex[20];
+            std::snprintf(hex, sizeof(hex), "%zx\r\n", piece.size());
+            out += hex;
+            out += piece;
+            out += "\r\n";
+        } else {
+            out += piece;
+        }
+    }
+    if (!more && r.chunked) out += "0\r\n\r\n";
+    return more;
+}
+
+// ------------------------------
+// gzip / deflate (bundled encoder, RFC 1950/1951/1952)
+// ------------------------------
+static const uint16_t kDeflateLenBase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t kDeflateLenExtra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t kDeflateDistBase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const uint8_t kDeflateDistExtra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+// Huffman code lengths for `freq`, none longer than `limit`. Frequencies are flattened until
+// the tree is shallow enough, which costs little against an optimal length-limited code.
+static void huffman_lengths(const uint32_t* freq, size_t n, unsigned limit, uint8_t* len) {
+    std::vector<uint32_t> f(freq, freq + n);
+    for (;;) {
+        std::fill(len, len + n, 0);
+        std::vector<size_t> leaves;
+        for (size_t i = 0; i < n; i++) if (f[i]) leaves.push_back(i);
+        if (leaves.empty()) return;
+        if (leaves.size() == 1) { len[leaves[0]] = 1; return; }
+
+        // Nodes 0..m-1 are the leaves; every merge adds a node above both inputs.
+        const size_t m = leaves.size();
+        std::vector<size_t> parent(2 * m - 1, 0);
+        std::priority_queue<std::pair<uint64_t, size_t>, std::vector<std::pair<uint64_t, size_t>>, std::greater<>> heap;
+        for (size_t k = 0; k < m; k++) heap.push({f[leaves[k]], k});
+        size_t next = m;
+        while (heap.size() > 1) {
+            const auto a = heap.top(); heap.pop();
+            const auto b = heap.top(); heap.pop();
+            parent[a.second] = parent[b.second] = next;
+            heap.push({a.first + b.first, next++});
+        }
+        std::vector<unsigned> depth(next, 0);
+        unsigned max_depth = 0;
+        for (size_t k = next - 1; k-- > 0;) depth[k] = depth[parent[k]] + 1;
+        for (size_t k = 0; k < m; k++) max_depth = std::max(max_depth, depth[k]);
+        if (max_depth <= limit) {
+            for (size_t k = 0; k < m; k++) len[leaves[k]] = (uint8_t)depth[k];
+            return;
+        }
+        for (auto& v : f) if (v) v = (v >> 1) | 1;
+    }
+}
+
+// Canonical codes (RFC 1951 3.2.2), stored bit-reversed since the stream is written LSB first.
+static void canonical_codes(const uint8_t* len, size_t n, uint16_t* code) {
+    uint16_t count[16] = {}, next[16] = {};
+    for (size_t i = 0; i < n; i++) count[len[i]]++;
+    count[0] = 0;
+    uint16_t c = 0;
+    for (int bits = 1; bits < 16; bits++) next[bits] = c = (uint16_t)((c + count[bits - 1]) << 1);
+    for (size_t i = 0; i < n; i++) {
+        if (!len[i]) continue;
+        const uint16_t v = next[len[i]]++;
+        uint16_t r = 0;
+        for (unsigned k = 0; k < len[i]; k++) r |= (uint16_t)(((v >> k) & 1u) << (len[i] - 1 - k));
+        code[i] = r;
+    }
+}
+
+// LZ77 over a 32 KiB window with hash chains (lazy matching from level 4), then one Huffman
+// block per slice of input with dynamic or fixed codes, whichever comes out smaller. The level
+// (1-9) only sets how hard matches are searched for. Input may arrive in pieces.
+class DeflateEncoder {
+public:
+    explicit DeflateEncoder(int level)
+        : max_chain_(level <= 1 ? 4 : level <= 3 ? 16 : level <= 6 ? 64 : level <= 8 ? 256 : 1024),
+          nice_len_(level <= 3 ? 32 : level <= 6 ? 128 : kMaxMatch), lazy_(level >= 4),
+          head_(kHashSize, -1), prev_(kWindow, -1) {}
+
+    // Compresses `n` bytes; `last` ends the stream. Only whole bytes are appended to `out`,
+    // the final partial byte follows with the last call.
+    void write(const char* in, size_t n, bool last, std::string& out) {
+        do {
+            const size_t take = std::min<size_t>(n, 64 * 1024);
+            block(in, take, last && take == n, out);
+            in += take;
+            n -= take;
+        } while (n > 0);
+    }
+
+private:
+    static const size_t kWindow = 32768;
+    static const size_t kHashSize = 1 << 15;
+    static const size_t kMinMatch = 3, kMaxMatch = 258;
+
+    struct Token {
+        uint16_t lit_or_len;
+        uint16_t dist; // 0 for a literal
+    };
+
+    void block(const char* in, size_t n, bool last, std::string& out) {
+        slide();
+        buf_.append(in, n);
+        const unsigned char* b = (const unsigned char*)buf_.data();
+        const size_t end = buf_.size();
+        tokens_.clear();
+
+        // A match found at i is held back one byte in case i+1 starts a longer one.
+        size_t i = end - n, prev_len = 0, prev_dist = 0;
+        while (i < end) {
+            size_t dist = 0, len = 0;
+            if (i + kMinMatch <= end) {
+                len = longest_match(b, i, end, &dist);
+                insert(b, i);
+            }
+            if (prev_len) {
+                if (prev_len >= len) {
+                    tokens_.push_back({(uint16_t)prev_len, (uint16_t)prev_dist});
+                    const size_t stop = i - 1 + prev_len;
+                    for (size_t k = i + 1; k < stop; k++) if (k + kMinMatch <= end) insert(b, k);
+                    i = stop;
+                    prev_len = 0;
+                    continue;
+                }
+                tokens_.push_back({b[i - 1], 0});
+                prev_len = 0;
+            }
+            if (len >= kMinMatch && lazy_ && len < nice_len_) {
+                prev_len = len;
+                prev_dist = dist;
+                i++;
+            } else if (len >= kMinMatch) {
+                tokens_.push_back({(uint16_t)len, (uint16_t)dist});
+                for (size_t k = i + 1; k < i + len; k++) if (k + kMinMatch <= end) insert(b, k);
+                i += len;
+            } else {
+                tokens_.push_back({b[i], 0});
+                i++;
+            }
+        }
+        emit_block(last, out);
+        if (last && bitcnt_ > 0) { out += (char)(bitbuf_ & 0xff); bitbuf_ = 0; bitcnt_ = 0; }
+    }
+
+    size_t longest_match(const unsigned char* b, size_t i, size_t end, size_t* dist) const {
+        const size_t max_len = std::min(kMaxMatch, end - i);
+        size_t best = 0;
+        int chain = max_chain_;
+        for (int32_t cand = head_[hash(b + i)]; cand >= 0 && chain-- > 0; cand = prev_[(size_t)cand & (kWindow - 1)]) {
+            const size_t c = (size_t)cand;
+            if (i - c > kWindow) break;
+            if (b[c + best] != b[i + best]) continue;
+            size_t len = 0;
+            while (len < max_len && b[c + len] == b[i + len]) len++;
+            if (len > best) {
+                best = len;
+                *dist = i - c;
+                if (len >= nice_len_ || len == max_len) break;
+            }
+        }
+        return best;
+    }
+
+    static unsigned len_code(size_t len) {
+        return (unsigned)(std::upper_bound(kDeflateLenBase, kDeflateLenBase + 29, len) - kDeflateLenBase - 1);
+    }
+    static unsigned dist_code(size_t dist) {
+        return (unsigned)(std::upper_bound(kDeflateDistBase, kDeflateDistBase + 30, dist) - kDeflateDistBase - 1);
+    }
+
+    void emit_block(bool last, std::string& out) {
+        uint32_t lit_freq[288] = {}, dist_freq[30] = {};
+        for (const Token& t : tokens_) {
+            if (!t.dist) { lit_freq[t.lit_or_len]++; continue; }
+            lit_freq[257 + len_code(t.lit_or_len)]++;
+            dist_freq[dist_code(t.dist)]++;
+        }
+        lit_freq[256] = 1;
+        // Keep both trees complete: at least two codes each.
+        if (std::count_if(lit_freq, lit_freq + 286, [](uint32_t f) { return f > 0; }) < 2) lit_freq[0]++;
+        if (std::count_if(dist_freq, dist_freq + 30, [](uint32_t f) { return f > 0; }) < 2) { dist_freq[0]++; dist_freq[1]++; }
+
+        uint8_t lit_len[288] = {}, dist_len[30] = {};
+        huffman_lengths(lit_freq, 286, 15, lit_len);
+        huffman_lengths(dist_freq, 30, 15, dist_len);
+
+        size_t hlit = 286, hdist = 30;
+        while (hlit > 257 && !lit_len[hlit - 1]) hlit--;
+        while (hdist > 1 && !dist_len[hdist - 1]) hdist--;
+
+        // Run-length coded lengths: 16 repeats the previous length, 17/18 are runs of zeros.
+        std::vector<uint8_t> all(lit_len, lit_len + hlit);
+        all.insert(all.end(), dist_len, dist_len + hdist);
+        std::vector<std::pair<uint8_t, uint8_t>> rle; // symbol, extra bits value
+        for (size_t i = 0; i < all.size();) {
+            const uint8_t v = all[i];
+            size_t run = 1;
+            while (i + run < all.size() && all[i + run] == v) run++;
+            i += run;
+            if (v == 0) {
+                while (run >= 11) { const size_t r = std::min<size_t>(run, 138); rle.push_back({18, (uint8_t)(r - 11)}); run -= r; }
+                if (run >= 3) { rle.push_back({17, (uint8_t)(run - 3)}); run = 0; }
+            } else {
+                rle.push_back({v, 0});
+                run--;
+                while (run >= 3) { const size_t r = std::min<size_t>(run, 6); rle.push_back({16, (uint8_t)(r - 3)}); run -= r; }
+            }
+            while (run--) rle.push_back({v, 0});
+        }
+        uint32_t cl_freq[19] = {};
+        for (const auto& r : rle) cl_freq[r.first]++;
+        uint8_t cl_len[19] = {};
+        huffman_lengths(cl_freq, 19, 7, cl_len);
+        static const uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        size_t hclen = 19;
+        while (hclen > 4 && !cl_len[kOrder[hclen - 1]]) hclen--;
+
+        // Extra bits cost the same either way, so only code bits are compared.
+        uint64_t dynamic_bits = 14 + 3 * hclen, fixed_bits = 0;
+        for (const auto& r : rle) dynamic_bits += cl_len[r.first] + (r.first == 16 ? 2 : r.first == 17 ? 3 : r.first == 18 ? 7 : 0);
+        for (size_t s = 0; s < 286; s++) {
+            dynamic_bits += (uint64_t)lit_freq[s] * lit_len[s];
+            fixed_bits += (uint64_t)lit_freq[s] * (s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8);
+        }
+        for (size_t s = 0; s < 30; s++) {
+            dynamic_bits += (uint64_t)dist_freq[s] * dist_len[s];
+            fixed_bits += (uint64_t)dist_freq[s] * 5;
+        }
+
+        put_bits(last ? 1u : 0u, 1, out);
+        if (dynamic_bits < fixed_bits) {
+            put_bits(2, 2, out);
+            put_bits((uint32_t)(hlit - 257), 5, out);
+            put_bits((uint32_t)(hdist - 1), 5, out);
+            put_bits((uint32_t)(hclen - 4), 4, out);
+            for (size_t k = 0; k < hclen; k++) put_bits(cl_len[kOrder[k]], 3, out);
+            uint16_t cl_code[19] = {};
+            canonical_codes(cl_len, 19, cl_code);
+            for (const auto& r : rle) {
+                put_bits(cl_code[r.first], cl_len[r.first], out);
+                if (r.first == 16) put_bits(r.second, 2, out);
+                else if (r.first == 17) put_bits(r.second, 3, out);
+                else if (r.first == 18) put_bits(r.second, 7, out);
+            }
+        } else {
+            put_bits(1, 2, out);
+            for (size_t s = 0; s < 288; s++) lit_len[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+            std::fill(dist_len, dist_len + 30, 5);
+        }
+
+        uint16_t lit_code[288] = {}, dist_code_bits[30] = {};
+        canonical_codes(lit_len, 288, lit_code);
+        canonical_codes(dist_len, 30, dist_code_bits);
+        for (const Token& t : tokens_) {
+            if (!t.dist) { put_bits(lit_code[t.lit_or_len], lit_len[t.lit_or_len], out); continue; }
+            const unsigned l = len_code(t.lit_or_len), d = dist_code(t.dist);
+            put_bits(lit_code[257 + l], lit_len[257 + l], out);
+            if (kDeflateLenExtra[l]) put_bits((uint32_t)(t.lit_or_len - kDeflateLenBase[l]), kDeflateLenExtra[l], out);
+            put_bits(dist_code_bits[d], dist_len[d], out);
+            if (kDeflateDistExtra[d]) put_bits((uint32_t)(t.dist - kDeflateDistBase[d]), kDeflateDistExtra[d], out);
+        }
+        put_bits(lit_code[256], lit_len[256], out); // end of block
+    }
+
+    // Keeps at least the last window of history; drops whole windows so prev_ slots stay aligned.
+    void slide() {
+        if (buf_.size() < 2 * kWindow) return;
+        const size_t drop = (buf_.size() - kWindow) / kWindow * kWindow;
+        buf_.erase(0, drop);
+        for (auto& h : head_) h = h >= (int32_t)drop ? h - (int32_t)drop : -1;
+        for (auto& p : prev_) p = p >= (int32_t)drop ? p - (int32_t)drop : -1;
+    }
+
+    static size_t hash(const unsigned char* p) {
+        return (((size_t)p[0] << 10) ^ ((size_t)p[1] << 5) ^ p[2]) & (kHashSize - 1);
+    }
+
+    void insert(const unsigned char* b, size_t i) {
+        const size_t h = hash(b + i);
+        prev_[i & (kWindow - 1)] = head_[h];
+        head_[h] = (int32_t)i;
+    }
+
+    void put_bits(uint32_t v, unsigned n, std::string& out) {
+        bitbuf_ |= (uint64_t)v << bitcnt_;
+        bitcnt_ += n;
+        while (bitcnt_ >= 8) { out += (char)(bitbuf_ & 0xff); bitbuf_ >>= 8; bitcnt_ -= 8; }
+    }
+
+    const int max_chain_;
+    const size_t nice_len_;
+    const bool lazy_;
+    std::vector<int32_t> head_, prev_;
+    std::string buf_; // history window + current slice
+    std::vector<Token> tokens_;
+    uint64_t bitbuf_ = 0;
+    unsigned bitcnt_ = 0;
+};
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char* p, size_t n) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+enum ContentEncoding { kEncIdentity, kEncGzip, kEncDeflate };
+
+// gzip (RFC 1952) or HTTP "deflate", which is the zlib wrapper (RFC 1950), around DeflateEncoder.
+class HttpCompressor {
+public:
+    HttpCompressor(ContentEncoding enc, int level) : enc_(enc), deflate_(level) {}
+
+    void write(std::string_view in, bool last, std::string& out) {
+        if (!started_) {
+            started_ = true;
+            if (enc_ == kEncGzip) out.append("\x1f\x8b\x08\0\0\0\0\0\0\xff", 10);
+            else out.append("\x78\x01", 2);
+        }
+        const unsigned char* p = (const unsigned char*)in.data();
+        if (enc_ == kEncGzip) crc_ = crc32_update(crc_, p, in.size());
+        else {
+            for (size_t i = 0; i < in.size(); i++) { a_ = (a_ + p[i]) % 65521; b_ = (b_ + a_) % 65521; }
+        }
+        size_ += in.size();
+        deflate_.write(in.data(), in.size(), last, out);
+        if (!last) return;
+        auto le32 = [&](uint32_t v) { for (int k = 0; k < 4; k++) out += (char)((v >> (8 * k)) & 0xff); };
+        if (enc_ == kEncGzip) { le32(crc_); le32((uint32_t)size_); }
+        else { const uint32_t adler = (b_ << 16) | a_; for (int k = 3; k >= 0; k--) out += (char)((adler >> (8 * k)) & 0xff); }
+    }
+
+private:
+    ContentEncoding enc_;
+    DeflateEncoder deflate_;
+    bool started_ = false;
+    uint32_t crc_ = 0, a_ = 1, b_ = 0;
+    uint64_t size_ = 0;
+};
+
+static std::string compress_body(std::string_view body, ContentEncoding enc, int level) {
+    std::string out;
+    out.reserve(body.size() / 3 + 64);
+    HttpCompressor(enc, level).write(body, true, out);
+    return out;
+}
+
+// Compresses another body stream piece by piece.
+class CompressedStream : public BodyStream {
+public:
+    CompressedStream(std::unique_ptr<BodyStream> inner, ContentEncoding enc, int level)
+        : inner_(std::move(inner)), z_(enc, level) {}
+
+    bool next(std::string& out, size_t budget) override {
+        piece_.clear();
+        const bool more = inner_->next(piece_, budget);
+        z_.write(piece_, !more, out);
+        return more;
+    }
+
+private:
+    std::unique_ptr<BodyStream> inner_;
+    HttpCompressor z_;
+    std::string piece_;
+};
+
+struct CompressionOptions {
+    int level = 6;          // 1-9; 0 turns compression off
+    size_t min_bytes = 1024; // smaller bodies are sent as is
+};
+
+static const char* encoding_name(ContentEncoding enc) {
+    return enc == kEncGzip ? "gzip" : enc == kEncDeflate ? "deflate" : "identity";
+}
+
+// Picks from an Accept-Encoding value: the highest q wins, gzip before deflate on a tie;
+// q=0 refuses a coding and "*" stands for gzip.
+static ContentEncoding pick_encoding(std::string_view accept) {
+    double best_q = 0, gzip_q = -1, deflate_q = -1, any_q = -1;
+    while (!accept.empty()) {
+        const size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+        const size_t semi = item.find(';');
+        std::string coding(item.substr(0, semi));
+        coding.erase(0, coding.find_first_not_of(" \t"));
+        coding.erase(coding.find_last_not_of(" \t") + 1);
+        for (char& c : coding) c = (char)std::tolower((unsigned char)c);
+        double q = 1;
+        if (semi != std::string_view::npos) {
+            const std::string params(item.substr(semi + 1));
+            const size_t at = params.find("q=");
+            if (at != std::string::npos) q = std::atof(params.c_str() + at + 2);
+        }
+        if (coding == "gzip" || coding == "x-gzip") gzip_q = q;
+        else if (coding == "deflate") deflate_q = q;
+        else if (coding == "*") any_q = q;
+    }
+    if (gzip_q < 0) gzip_q = any_q;
+    if (deflate_q < 0) deflate_q = any_q;
+    ContentEncoding enc = kEncIdentity;
+    if (gzip_q > best_q) { best_q = gzip_q; enc = kEncGzip; }
+    if (deflate_q > best_q) enc = kEncDeflate;
+    return enc;
+}
+
+// ------------------------------
+// ISO-8601 timestamps <-> epoch seconds
+// ------------------------------
+// "YYYY-MM-DDTHH:MM:SS" with optional "Z" / "+HH:MM" / "-HH:MM". The wall-clock part is
+// converted as UTC; *tz_min receives the offset (kTzNone when none was written, kTzZulu for "Z").
+static const int16_t kTzNone = 0x7fff;
+static const int16_t kTzZulu = 0x7ffe;
+
+static long long days_from_civil(long long y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const long long era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long)doe - 719468;
+}
+
+static bool parse_iso8601(std::string_view s, long long* epoch, int16_t* tz_min) {
+    auto num = [&](size_t at, size_t len, int* out) {
+        int v = 0;
+        for (size_t i = at; i < at + len; i++) {
+            if (i >= s.size() || !std::isdigit((unsigned char)s[i])) return false;
+            v = v * 10 + (s[i] - '0');
+        }
+        *out = v;
+        return true;
+    };
+    int y, mo, d, h, mi, sec;
+    if (s.size() < 19 || s[4] != '-' || s[7] != '-' || s[10] != 'T' || s[13] != ':' || s[16] != ':') return false;
+    if (!num(0, 4, &y) || !num(5, 2, &mo) || !num(8, 2, &d) || !num(11, 2, &h) || !num(14, 2, &mi) || !num(17, 2, &sec)) return false;
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || sec > 60) return false;
+    int16_t tz = kTzNone;
+    if (s.size() == 20 && s[19] == 'Z') {
+        tz = kTzZulu;
+    } else if (s.size() == 25 && (s[19] == '+' || s[19] == '-') && s[22] == ':') {
+        int th, tm;
+        if (!num(20, 2, &th) || !num(23, 2, &tm) || th > 23 || tm > 59) return false;
+        tz = (int16_t)((s[19] == '-' ? -1 : 1) * (th * 60 + tm));
+    } else if (s.size() != 19) {
+        return false;
+    }
+    *epoch = days_from_civil(y, (unsigned)mo, (unsigned)d) * 86400 + h * 3600 + mi * 60 + sec;
+    *tz_min = tz;
+    return true;
+}
+
+static std::string format_iso8601(long long epoch, int16_t tz_min) {
+    long long days = epoch / 86400, rem = epoch % 86400;
+    if (rem < 0) { rem += 86400; days--; }
+    // civil_from_days
+    days += 719468;
+    const long long era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned doe = (unsigned)(days - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+    const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    const long long y = (long long)yoe + era * 400 + (m <= 2);
+
+    char buf[40];
+    int n = std::snprintf(buf, sizeof(buf), "%04lld-%02u-%02uT%02d:%02d:%02d", y, m, d,
+                          (int)(rem / 3600), (int)(rem % 3600 / 60), (int)(rem % 60));
+    std::string out(buf, (size_t)n);
+    if (tz_min == kTzZulu) out += 'Z';
+    else if (tz_min != kTzNone) {
+        const int a = tz_min < 0 ? -tz_min : tz_min;
+        std::snprintf(buf, sizeof(buf), "%c%02d:%02d", tz_min < 0 ? '-' : '+', a / 60, a % 60);
+        out += buf;
+    }
+    return out;
+}
+
+// ------------------------------
+// in-memory asset index (latest record per asset)
+// ------------------------------
+// Records live in one block: the AssetRecord header, then the JSON text, then any field text
+// that does not lie inside the JSON. The fields are views into that block, so a record is a
+// single allocation and nothing in it needs a destructor.
+struct AssetRecord {
+    std::string_view json; // the record exactly as it was posted, served verbatim by /api/assets
+    std::string_view id, hostname, os, cpu_cores, ram_mb, ip, timestamp;
+    long long cpu_cores_num = -1, ram_mb_num = -1;
+    long long ts_utc = LLONG_MIN; // timestamp as UTC epoch seconds; LLONG_MIN when it is not ISO-8601
+};
+static_assert(std::is_trivially_destructible<AssetRecord>::value, "records are freed as raw arena memory");
+
+// Bump allocator for record blocks. Every block keeps its chunk alive through the shared_ptr
+// aliasing constructor, so a chunk goes back to the heap with the last record carved from it.
+// Chunks are small so that a few long-lived records (hosts that stopped reporting) pin little.
+class RecordArena {
+public:
+    static const size_t kChunkBytes = 32 << 10;
+
+    // Returns `bytes` of 16-aligned storage; `owner` keeps it alive.
+    char* alloc(size_t bytes, std::shared_ptr<char>& owner) {
+        bytes = (bytes + 15) & ~size_t(15);
+        if (bytes > kChunkBytes / 4) return alloc_block(bytes, owner);
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!chunk_ || used_ + bytes > kChunkBytes) {
+            alloc_block(kChunkBytes, chunk_);
+            used_ = 0;
+        }
+        owner = chunk_;
+        char* p = chunk_.get() + used_;
+        used_ += bytes;
+        return p;
+    }
+
+    static char* alloc_block(size_t bytes, std::shared_ptr<char>& owner) {
+        owner = std::shared_ptr<char>(new char[bytes], std::default_delete<char[]>());
+        return owner.get();
+    }
+
+private:
+    std::mutex mu_;
+    std::shared_ptr<char> chunk_;
+    size_t used_ = 0;
+};
+
+// Offsets are applied so records from agents in different zones compare correctly; a
+// timestamp without an offset is taken as UTC.
+static long long timestamp_utc(std::string_view ts) {
+    long long epoch;
+    int16_t tz;
+    if (!parse_iso8601(ts, &epoch, &tz)) return LLONG_MIN;
+    if (tz != kTzNone && tz != kTzZulu) epoch -= tz * 60LL;
+    return epoch;
+}
+
+// Builds a record from a body that parse_asset_json() already accepted; the view's fields
+// point into `json`, so nothing is scanned twice. Fields from elsewhere (columnar rows) are
+// copied in behind the JSON. Without an arena the record gets a block of its own.
+static std::shared_ptr<const AssetRecord> make_asset_record(std::string_view json, const AssetView& v,
+                                                            RecordArena* arena = nullptr) {
+    const std::string_view AssetView::*fields[] = {&AssetView::id, &AssetView::hostname, &AssetView::os,
+                                                   &AssetView::cpu_cores, &AssetView::ram_mb, &AssetView::ip,
+                                                   &AssetView::timestamp};
+    std::string_view AssetRecord::*dest[] = {&AssetRecord::id, &AssetRecord::hostname, &AssetRecord::os,
+                                             &AssetRecord::cpu_cores, &AssetRecord::ram_mb, &AssetRecord::ip,
+                                             &AssetRecord::timestamp};
+    auto inside = [&](std::string_view f) {
+        return !f.empty() && f.data() >= json.data() && f.data() + f.size() <= json.data() + json.size();
+    };
+    size_t bytes = sizeof(AssetRecord) + json.size();
+    for (auto f : fields) if (!inside(v.*f)) bytes += (v.*f).size();
+
+    std::shared_ptr<char> owner;
+    char* mem = arena ? arena->alloc(bytes, owner) : RecordArena::alloc_block(bytes, owner);
+    AssetRecord* rec = new (mem) AssetRecord();
+    char* text = mem + sizeof(AssetRecord);
+    if (!json.empty()) std::memcpy(text, json.data(), json.size());
+    rec->json = std::string_view(text, json.size());
+    char* extra = text + json.size();
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        std::string_view f = v.*fields[i];
+        if (f.empty()) continue;
+        if (inside(f)) {
+            rec->*dest[i] = std::string_view(text + (f.data() - json.data()), f.size());
+        } else {
+            std::memcpy(extra, f.data(), f.size());
+            rec->*dest[i] = std::string_view(extra, f.size());
+            extra += f.size();
+        }
+    }
+    rec->cpu_cores_num = v.cpu_cores_num;
+    rec->ram_mb_num = v.ram_mb_num;
+    rec->ts_utc = timestamp_utc(rec->timestamp);
+    return std::shared_ptr<const AssetRecord>(owner, rec);
+}
+
+// Where a query page starts. The first page leaves `order` at 0 and lets the planner pick the
+// index to walk; later pages resume in the order the first one used, so paging never skips or
+// repeats a match because the planner changed its mind.
+struct AssetCursor {
+    char order = 0;   // 0: first page; 's': slot order; 'h', 't', 'r': hostname, timestamp, ram_mb index order
+    size_t slot = 0;  // first slot to consider, or the slot of the index entry to resume at
+    long long num = 0; // index value to resume at for 't' and 'r'
+    std::string host;  // index value to resume at for 'h'
+};
+
+static const size_t kQueryPlanProbe = 4096; // entries counted per ordered index when planning a query
+
+// Filters for GET /api/assets?...; members left at their defaults match everything.
+// String filters compare against the field text as it appears inside the JSON string.
+struct AssetQuery {
+    bool has_os = false, has_prefix = false;
+    std::string os, hostname_prefix;
+    long long min_ram_mb = -1;   // -1: no filter ("N/A" never passes one)
+    long long since = LLONG_MIN; // UTC epoch seconds
+    AssetCursor cursor;
+    size_t limit = SIZE_MAX;     // at least 1
+
+    bool matches(const AssetRecord& r) const {
+        if (has_os && r.os != os) return false;
+        if (has_prefix && r.hostname.compare(0, hostname_prefix.size(), hostname_prefix) != 0) return false;
+        if (min_ram_mb >= 0 && r.ram_mb_num < min_ram_mb) return false;
+        if (since != LLONG_MIN && (r.ts_utc == LLONG_MIN || r.ts_utc < since)) return false;
+        return true;
+    }
+};
+
+static inline unsigned ctz64(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (unsigned)i;
+#else
+    return (unsigned)__builtin_ctzll(v);
+#endif
+}
+
+static inline unsigned msb64(uint64_t v) { // index of the highest set bit; v != 0
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanReverse64(&i, v);
+    return (unsigned)i;
+#else
+    return 63u - (unsigned)__builtin_clzll(v);
+#endif
+}
+
+// Running aggregates of one numeric field, for GET /api/stats. `values` keeps each distinct
+// value with its count, so min and max stay exact when assets change; the histogram has
+// power-of-two buckets.
+struct NumStats {
+    static const size_t kBuckets = 48; // bucket b holds 2^(b-1) < v <= 2^b; bucket 0 holds v <= 1
+    size_t count = 0;
+    long long sum = 0;
+    std::map<long long, size_t> values;
+    size_t hist[kBuckets] = {};
+
+    static size_t bucket(long long v) {
+        return v <= 1 ? 0 : std::min<size_t>(kBuckets - 1, msb64((uint64_t)(v - 1)) + 1);
+    }
+    void add(long long v) {
+        count++;
+        sum += v;
+        values[v]++;
+        hist[bucket(v)]++;
+    }
+    void remove(long long v) {
+        count--;
+        sum -= v;
+        auto it = values.find(v);
+        if (it != values.end() && --it->second == 0) values.erase(it);
+        hist[bucket(v)]--;
+    }
+    // Absent values (< 0) are not counted.
+    void replace(long long was, long long now) {
+        if (was == now) return;
+        if (was >= 0) remove(was);
+        if (now >= 0) add(now);
+    }
+};
+
+static long long utc_hour(long long ts) { return ts >= 0 ? ts / 3600 : -((-ts + 3599) / 3600); }
+
+// Assets by the age of their last report, in whole hours: under 1h, 1-24h, 1-7d and over 7d.
+// The last week sits in a ring of hourly counts behind one counter per bucket; roll() moves
+// counts between the counters as hour marks pass, and whatever leaves the week collapses into
+// `older`, so the size stays fixed however long assets have been gone. Reports dated after
+// `head` wait in `ahead` until the clock gets there.
+struct SeenBuckets {
+    static const long long kHours = 24 * 7;
+    enum { kUnder1h, kUnder24h, kUnder7d, kOlder };
+
+    std::array<size_t, (size_t)kHours> ring{}; // assets last seen in hour h, head - kHours < h <= head
+    std::map<long long, size_t> ahead;         // hour -> assets, for hours after head
+    size_t ahead_total = 0;
+    size_t counts[4] = {};                     // by age relative to head; kUnder1h excludes `ahead`
+    long long head = LLONG_MIN;
+
+    static size_t slot(long long h) { return (size_t)(((h % kHours) + kHours) % kHours); }
+    static int bucket_of(long long age) { return age < 1 ? kUnder1h : age < 24 ? kUnder24h : age < kHours ? kUnder7d : kOlder; }
+
+    void add(long long h, long long now_hour) { roll(now_hour); move(h, 1); }
+    void remove(long long h, long long now_hour) { roll(now_hour); move(h, -1); }
+
+    // Advances head to `now_hour` one hour at a time (at most a week of steps).
+    void roll(long long now_hour) {
+        if (head == LLONG_MIN) { head = now_hour; return; }
+        if (now_hour <= head) return;
+        if (now_hour - head > kHours) { // the whole ring is older than a week by now
+            counts[kOlder] += counts[kUnder1h] + counts[kUnder24h] + counts[kUnder7d];
+            counts[kUnder1h] = counts[kUnder24h] = counts[kUnder7d] = 0;
+            ring.fill(0);
+            head = now_hour - kHours;
+            while (!ahead.empty() && ahead.begin()->first <= head) {
+                counts[kOlder] += ahead.begin()->second;
+                ahead_total -= ahead.begin()->second;
+                ahead.erase(ahead.begin());
+            }
+        }
+        while (head < now_hour) {
+            head++;
+            size_t& gone = ring[slot(head)]; // held hour head - kHours, now a week old
+            counts[kUnder7d] -= gone;
+            counts[kOlder] += gone;
+            gone = 0;
+            const size_t aged_1h = ring[slot(head - 1)], aged_24h = ring[slot(head - 24)];
+            counts[kUnder1h] -= aged_1h;
+            counts[kUnder24h] += aged_1h - aged_24h;
+            counts[kUnder7d] += aged_24h;
+            auto it = ahead.begin();
+            if (it != ahead.end() && it->first == head) {
+                ring[slot(head)] = it->second;
+                counts[kUnder1h] += it->second;
+                ahead_total -= it->second;
+                ahead.erase(it);
+            }
+        }
+    }
+
+    // The four buckets as of `now_hour`, without moving anything: the counters as they are when
+    // no hour mark has passed since the last write, otherwise summed from the ring (at most a
+    // week of slots plus the reports still ahead).
+    void read(long long now_hour, size_t out[4]) const {
+        if (head == LLONG_MIN || now_hour == head) {
+            std::copy(counts, counts + 4, out);
+            out[kUnder1h] += ahead_total;
+            return;
+        }
+        const size_t total = counts[kUnder1h] + counts[kUnder24h] + counts[kUnder7d] + counts[kOlder] + ahead_total;
+        out[kUnder1h] = in_hours(now_hour - 1, LLONG_MAX);
+        out[kUnder24h] = in_hours(now_hour - 24, now_hour - 1);
+        out[kUnder7d] = in_hours(now_hour - kHours, now_hour - 24);
+        out[kOlder] = total - out[kUnder1h] - out[kUnder24h] - out[kUnder7d];
+    }
+
+private:
+    void move(long long h, int d) {
+        if (h > head) {
+            auto it = ahead.emplace(h, 0).first;
+            it->second += d;
+            ahead_total += d;
+            if (!it->second) ahead.erase(it);
+        } else {
+            if (h > head - kHours) ring[slot(h)] += d;
+            counts[bucket_of(head - h)] += d;
+        }
+    }
+
+    // Assets last seen in hours a < h <= b that the ring or `ahead` can place.
+    size_t in_hours(long long a, long long b) const {
+        size_t n = 0;
+        for (long long h = std::max(a, head - kHours) + 1; h <= std::min(b, head); h++) n += ring[slot(h)];
+        for (auto it = ahead.upper_bound(a); it != ahead.end() && it->first <= b; ++it) n += it->second;
+        return n;
+    }
+};
+
+// Everything /api/stats reports for a set of assets, updated record by record.
+struct FleetStats {
+    size_t assets = 0;
+    NumStats cpu_cores, ram_mb;
+    size_t ram_na = 0;       // ram_mb reported as "N/A"
+    SeenBuckets seen;        // by UTC hour of the last report
+    size_t seen_unknown = 0; // timestamp not ISO-8601
+
+    void add(const AssetRecord& r) {
+        assets++;
+        replace(nullptr, &r);
+    }
+    void remove(const AssetRecord& r) {
+        assets--;
+        replace(&r, nullptr);
+    }
+    // Moves one asset's contribution from `was` to `now` (either may be null); fields that did
+    // not change are left alone.
+    void replace(const AssetRecord* was, const AssetRecord* now) {
+        cpu_cores.replace(was ? was->cpu_cores_num : -1, now ? now->cpu_cores_num : -1);
+        ram_mb.replace(was ? was->ram_mb_num : -1, now ? now->ram_mb_num : -1);
+        if (was && was->ram_mb == "N/A") ram_na--;
+        if (now && now->ram_mb == "N/A") ram_na++;
+        const long long h0 = was && was->ts_utc != LLONG_MIN ? utc_hour(was->ts_utc) : LLONG_MIN;
+        const long long h1 = now && now->ts_utc != LLONG_MIN ? utc_hour(now->ts_utc) : LLONG_MIN;
+        if (was && h0 == h1 && now) return;
+        const long long clock = utc_hour((long long)std::time(nullptr));
+        if (was) {
+            if (h0 == LLONG_MIN) seen_unknown--;
+            else seen.remove(h0, clock);
+        }
+        if (now) {
+            if (h1 == LLONG_MIN) seen_unknown++;
+            else seen.add(h1, clock);
+        }
+    }
+};
+
+// Holds the latest record per asset key so reads never rescan the JSONL history.
+//
+// Writers and readers do not share a lock. The key map is split into hash shards, each with
+// its own mutex and record arena, so request threads resolving deltas only meet on one shard.
+// The slots (one per key, first-seen order) are published as an immutable Snapshot of
+// copy-on-write chunks: readers load the current root and walk it without locking, while the
+// single writer copies just the chunks a batch touched and swaps in a new root. A scan that
+// holds a snapshot sees one consistent state however long it takes. The secondary indexes sit
+// behind a shared_mutex that the writer takes once per batch, around the root swap, so an index
+// read always matches the root it is paired with.
+class AssetStore {
+public:
+    static const size_t kChunkSlots = 256;
+    struct SlotChunk {
+        std::shared_ptr<const AssetRecord> recs[kChunkSlots];
+    };
+    struct Snapshot {
+        std::vector<std::shared_ptr<const SlotChunk>> chunks;
+        size_t size = 0;
+        uint64_t seq = 0;
+        const std::shared_ptr<const AssetRecord>& at(size_t slot) const {
+            return chunks[slot / kChunkSlots]->recs[slot % kChunkSlots];
+        }
+    };
+
+    // The change sequence starts at the startup time in microseconds, so sequence numbers (and
+    // the ETags built from them) from before a restart never match, and are recognised as stale.
+    explicit AssetStore(bool key_by_hostname = false)
+        : key_by_hostname_(key_by_hostname),
+          base_seq_((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::system_clock::now().time_since_epoch()).count()),
+          seq_(base_seq_) {
+        auto root = std::make_shared<Snapshot>();
+        root->seq = seq_;
+        root_ = std::move(root);
+    }
+
+    void set_key_by_hostname(bool on) { key_by_hostname_ = on; }
+
+    // Records without an id fall back to the hostname so they still collapse per host.
+    std::string key_of(std::string_view id, std::string_view hostname) const {
+        std::string key = (key_by_hostname_ || id.empty()) ? "host:" : "id:";
+        key.append(key_value(id, hostname));
+        return key;
+    }
+
+    // The part of key_of() that names the asset (its id or its hostname).
+    std::string_view key_value(std::string_view id, std::string_view hostname) const {
+        return key_by_hostname_ || id.empty() ? hostname : id;
+    }
+
+    // Builds a record in the arena of the shard its key belongs to.
+    std::shared_ptr<const AssetRecord> make_record(std::string_view json, const AssetView& v) const {
+        return make_asset_record(json, v, &shards_[shard_of(key_value(v.id, v.hostname))].arena);
+    }
+
+    // The latest record for `key`, including upserts not yet published to readers.
+    std::shared_ptr<const AssetRecord> find(const std::string& key) const {
+        const KeyShard& sh = shards_[shard_of(std::string_view(key).substr(key.find(':') + 1))];
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.map.find(key);
+        return it == sh.map.end() ? nullptr : it->second.rec;
+    }
+
+    // Writer side. upsert() alone is invisible to readers until publish(); apply() does both
+    // for a batch. Only one thread may write at a time.
+    void upsert(std::shared_ptr<const AssetRecord> rec) {
+        std::unique_lock<std::shared_mutex> lk(index_mu_);
+        upsert_locked(std::move(rec));
+    }
+
+    void apply(const std::vector<std::shared_ptr<const AssetRecord>>& batch) {
+        std::unique_lock<std::shared_mutex> lk(index_mu_);
+        for (const auto& r : batch) upsert_locked(r);
+        publish_locked();
+    }
+
+    void publish() {
+        std::unique_lock<std::shared_mutex> lk(index_mu_);
+        publish_locked();
+    }
+
+    // The current root. It never changes; hold it to read the store as of one moment.
+    std::shared_ptr<const Snapshot> snapshot() const { return std::atomic_load(&root_); }
+
+    // Sequence number of the latest published change; it grows with every upsert.
+    uint64_t seq() const { return snapshot()->seq; }
+
+    // Appends (slot, record) for every asset changed after `since`, ordered by slot, and returns
+    // the current sequence. A `since` that this process never issued (0, or from before a
+    // restart) yields every asset and sets *reset.
+    uint64_t changes_since(uint64_t since, std::vector<std::pair<size_t, std::shared_ptr<const AssetRecord>>>& out, bool* reset) const {
+        std::vector<size_t> slots;
+        std::shared_ptr<const Snapshot> snap;
+        {
+            std::shared_lock<std::shared_mutex> lk(index_mu_);
+            snap = snapshot();
+            *reset = since < base_seq_ || since > snap->seq;
+            if (*reset) since = base_seq_;
+            for (auto it = by_seq_.upper_bound(since); it != by_seq_.end(); ++it) slots.push_back(it->second);
+        }
+        std::sort(slots.begin(), slots.end());
+        for (size_t slot : slots) out.emplace_back(slot, snap->at(slot));
+        return snap->seq;
+    }
+
+    // Evaluates `q` and appends up to q.limit matches to `out`. A first page is driven by
+    // whichever source promises the fewest candidates: the whole store or the os bitset, read in
+    // slot order, or one of the ordered indexes, read in its value order. Those have no cheap
+    // range size, so planning counts each only up to kQueryPlanProbe entries. Every walk stops
+    // at the first match past the page, so a page costs what it takes to find limit + 1
+    // matches, not the size of the range. *next receives the cursor of the following page; its
+    // order stays 0 when there is none.
+    size_t query(const AssetQuery& q, std::vector<std::shared_ptr<const AssetRecord>>& out, AssetCursor* next) const {
+        *next = AssetCursor();
+        const AssetCursor& at = q.cursor;
+        enum Drive { kScan, kOs, kHost, kTs, kRam } drive = kScan;
+        std::vector<uint64_t> os_words; // copy of the os bitset from the cursor's word on
+        std::shared_ptr<const Snapshot> snap;
+        const size_t start = out.size();
+        auto take = [&](size_t slot) { // false once a match no longer fits the page
+            const auto& r = snap->at(slot);
+            if (!q.matches(*r)) return true;
+            if (out.size() - start == q.limit) return false;
+            out.push_back(r);
+            return true;
+        };
+        {
+            std::shared_lock<std::shared_mutex> lk(index_mu_);
+            snap = snapshot();
+            if (at.order == 's' && at.slot >= snap->size) return 0;
+
+            const OsBits* os = nullptr;
+            if (q.has_os) {
+                auto it = by_os_.find(q.os);
+                if (it == by_os_.end()) return 0;
+                os = &it->second;
+            }
+            auto in_prefix = [&](const std::pair<std::string, size_t>& e) {
+                return e.first.compare(0, q.hostname_prefix.size(), q.hostname_prefix) == 0;
+            };
+            auto any = [](const std::pair<long long, size_t>&) { return true; };
+            // On a later page the walk resumes at the cursor's entry, or at the range start if that comes later.
+            auto from = [&](auto lo, auto resume, char order) { return at.order == order ? std::max(lo, resume) : lo; };
+            const auto host_lo = by_host_.lower_bound(from(std::make_pair(q.hostname_prefix, (size_t)0), std::make_pair(at.host, at.slot), 'h'));
+            const auto ts_lo = by_ts_.lower_bound(from(std::make_pair(q.since, (size_t)0), std::make_pair(at.num, at.slot), 't'));
+            const auto ram_lo = by_ram_.lower_bound(from(std::make_pair(q.min_ram_mb, (size_t)0), std::make_pair(at.num, at.slot), 'r'));
+
+            if (at.order == 0) {
+                size_t best = snap->size;
+                if (os && os->count < best) { best = os->count; drive = kOs; }
+                // A range that reaches the probe limit is only known to be large; it still beats a full scan.
+                auto probe = [&](auto it, const auto& idx, const auto& inside, Drive as) {
+                    const size_t stop = std::min(best, kQueryPlanProbe);
+                    size_t n = 0;
+                    for (; it != idx.end() && n < stop && inside(*it); ++it) n++;
+                    if (n < best && (n < kQueryPlanProbe || drive == kScan)) { best = n; drive = as; }
+                };
+                if (q.has_prefix) probe(host_lo, by_host_, in_prefix, kHost);
+                if (q.since != LLONG_MIN) probe(ts_lo, by_ts_, any, kTs);
+                if (q.min_ram_mb >= 0) probe(ram_lo, by_ram_, any, kRam);
+            } else if (at.order == 'h') {
+                drive = kHost;
+            } else if (at.order == 't') {
+                drive = kTs;
+            } else if (at.order == 'r') {
+                drive = kRam;
+            } else if (os) {
+                drive = kOs;
+            }
+
+            // The ordered indexes are read here, under the lock the snapshot was taken under,
+            // so every slot they name is in it.
+            auto walk = [&](auto it, const auto& idx, const auto& inside, char order) {
+                for (; it != idx.end() && inside(*it); ++it) {
+                    if (take(it->second)) continue;
+                    next->order = order;
+                    next->slot = it->second;
+                    return it;
+                }
+                return idx.end();
+            };
+            if (drive == kHost) {
+                const auto it = walk(host_lo, by_host_, in_prefix, 'h');
+                if (it != by_host_.end()) next->host = it->first;
+            } else if (drive == kTs || drive == kRam) {
+                const auto& idx = drive == kTs ? by_ts_ : by_ram_;
+                const auto it = walk(drive == kTs ? ts_lo : ram_lo, idx, any, drive == kTs ? 't' : 'r');
+                if (it != idx.end()) next->num = it->first;
+            } else if (drive == kOs && at.slot / 64 < os->words.size()) {
+                os_words.assign(os->words.begin() + (std::ptrdiff_t)(at.slot / 64), os->words.end());
+            }
+        }
+        if (drive != kScan && drive != kOs) return out.size() - start;
+
+        auto stop_at = [&](size_t slot) { next->order = 's'; next->slot = slot; };
+        if (drive == kScan) {
+            for (size_t i = at.slot; i < snap->size; i++) {
+                if (!take(i)) { stop_at(i); break; }
+            }
+        } else {
+            const size_t w0 = at.slot / 64;
+            for (size_t w = 0; w < os_words.size(); w++) {
+                uint64_t bits = os_words[w];
+                if (w == 0) bits &= ~0ULL << (at.slot % 64);
+                for (; bits; bits &= bits - 1) {
+                    const size_t slot = (w0 + w) * 64 + ctz64(bits);
+                    if (!take(slot)) { stop_at(slot); return out.size() - start; }
+                }
+            }
+        }
+        return out.size() - start;
+    }
+
+    // Copies up to `max` record pointers starting at slot `from` out of `snap`.
+    static size_t read_range(const Snapshot& snap, size_t from, size_t max, std::vector<std::shared_ptr<const AssetRecord>>& out) {
+        const size_t end = std::min(snap.size, from + max);
+        for (size_t i = from; i < end; i++) out.push_back(snap.at(i));
+        return end > from ? end - from : 0;
+    }
+
+    size_t size() const { return snapshot()->size; }
+
+    // Calls f(all, groups) under the index lock, with the aggregates as of the latest applied
+    // batch; groups pairs each os with the aggregates of its assets. Nothing here scans assets.
+    void read_stats(const std::function<void(const FleetStats&, const std::vector<std::pair<std::string_view, const FleetStats*>>&)>& f) const {
+        std::shared_lock<std::shared_mutex> lk(index_mu_);
+        std::vector<std::pair<std::string_view, const FleetStats*>> groups;
+        groups.reserve(by_os_.size());
+        for (const auto& kv : by_os_) groups.emplace_back(kv.first, &kv.second.stats);
+        std::sort(groups.begin(), groups.end());
+        f(stats_, groups);
+    }
+
+private:
+    static const size_t kShards = 16;
+    struct KeyEntry {
+        size_t slot;
+        std::shared_ptr<const AssetRecord> rec;
+    };
+    struct KeyShard {
+        mutable std::mutex mu;
+        std::unordered_map<std::string, KeyEntry> map;
+        mutable RecordArena arena; // allocating does not change what the store holds
+    };
+    struct OsBits {
+        std::vector<uint64_t> words; // bit i set: slot i currently holds this os
+        size_t count = 0;
+        FleetStats stats;                  // the assets of this os, for group_by=os
+        std::unique_ptr<std::string> name; // by_os_ keys view this, so lookups need no std::string
+    };
+
+    static size_t shard_of(std::string_view key_value) { return std::hash<std::string_view>()(key_value) % kShards; }
+
+    void upsert_locked(std::shared_ptr<const AssetRecord> rec) {
+        std::string key = key_of(rec->id, rec->hostname);
+        KeyShard& sh = shards_[shard_of(std::string_view(key).substr(key.find(':') + 1))];
+        size_t slot;
+        bool fresh = false;
+        {
+            std::lock_guard<std::mutex> lk(sh.mu);
+            auto it = sh.map.find(key);
+            if (it != sh.map.end()) {
+                slot = it->second.slot;
+                it->second.rec = rec;
+            } else {
+                slot = size_;
+                sh.map.emplace(std::move(key), KeyEntry{slot, rec});
+                fresh = true;
+            }
+        }
+        const size_t c = slot / kChunkSlots;
+        if (fresh) {
+            size_++;
+            slot_seq_.push_back(0);
+            if (c == work_.size()) {
+                work_.push_back(std::make_shared<SlotChunk>());
+                owned_.push_back(true);
+            }
+        }
+        if (!owned_[c]) { // shared with a published root: copy before writing
+            work_[c] = std::make_shared<SlotChunk>(*work_[c]);
+            owned_[c] = true;
+        }
+        auto& cell = work_[c]->recs[slot % kChunkSlots];
+        if (fresh) {
+            index(slot, *rec);
+            by_seq_.emplace(seq_ + 1, slot);
+        } else {
+            reindex(slot, *cell, *rec);
+            auto node = by_seq_.extract(slot_seq_[slot]);
+            node.key() = seq_ + 1;
+            by_seq_.insert(std::move(node));
+        }
+        cell = std::move(rec);
+        slot_seq_[slot] = ++seq_;
+    }
+
+    void publish_locked() {
+        auto root = std::make_shared<Snapshot>();
+        root->chunks.assign(work_.begin(), work_.end());
+        root->size = size_;
+        root->seq = seq_;
+        std::atomic_store(&root_, std::shared_ptr<const Snapshot>(std::move(root)));
+        std::fill(owned_.begin(), owned_.end(), false);
+    }
+
+    void index(size_t slot, const AssetRecord& r) {
+        index_os(slot, r);
+        stats_.add(r);
+        by_host_.emplace(std::string(r.hostname), slot);
+        if (r.ts_utc != LLONG_MIN) by_ts_.emplace(r.ts_utc, slot);
+        if (r.ram_mb_num >= 0) by_ram_.emplace(r.ram_mb_num, slot);
+    }
+
+    // Like unindex(was) + index(now), but entries that change are moved by reusing their nodes,
+    // so an asset that reports again (the usual write) updates the indexes without allocating.
+    void reindex(size_t slot, const AssetRecord& was, const AssetRecord& now) {
+        stats_.replace(&was, &now);
+        if (was.os != now.os) {
+            unindex_os(slot, was);
+            index_os(slot, now);
+        } else {
+            auto it = by_os_.find(was.os);
+            if (it != by_os_.end()) it->second.stats.replace(&was, &now);
+        }
+        if (was.hostname != now.hostname) {
+            relink(by_host_, true, {std::string(was.hostname), slot}, true, {std::string(now.hostname), slot});
+        }
+        relink(by_ts_, was.ts_utc != LLONG_MIN, {was.ts_utc, slot}, now.ts_utc != LLONG_MIN, {now.ts_utc, slot});
+        relink(by_ram_, was.ram_mb_num >= 0, {was.ram_mb_num, slot}, now.ram_mb_num >= 0, {now.ram_mb_num, slot});
+    }
+
+    template <class Entry>
+    static void relink(std::set<Entry>& idx, bool had, const Entry& from, bool has, const Entry& to) {
+        if (had && has && from == to) return;
+        if (had) {
+            auto node = idx.extract(from);
+            if (node && has) {
+                node.value() = to;
+                idx.insert(std::move(node));
+                return;
+            }
+        }
+        if (has) idx.insert(to);
+    }
+
+    void index_os(size_t slot, const AssetRecord& r) {
+        auto it = by_os_.find(r.os);
+        if (it == by_os_.end()) {
+            OsBits b;
+            b.name.reset(new std::string(r.os));
+            const std::string_view key = *b.name;
+            it = by_os_.emplace(key, std::move(b)).first;
+        }
+        OsBits& b = it->second;
+        if (b.words.size() <= slot / 64) b.words.resize(slot / 64 + 1);
+        b.words[slot / 64] |= 1ULL << (slot % 64);
+        b.count++;
+        b.stats.add(r);
+    }
+
+    void unindex_os(size_t slot, const AssetRecord& r) {
+        auto it = by_os_.find(r.os);
+        if (it == by_os_.end()) return;
+        it->second.words[slot / 64] &= ~(1ULL << (slot % 64));
+        it->second.stats.remove(r);
+        if (--it->second.count == 0) by_os_.erase(it);
+    }
+
+    bool key_by_hostname_;
+    const uint64_t base_seq_;
+    KeyShard shards_[kShards];
+    std::shared_ptr<const Snapshot> root_; // accessed with std::atomic_load/atomic_store only
+
+    // Writer state, guarded by index_mu_ (exclusive) and read by index readers (shared).
+    mutable std::shared_mutex index_mu_;
+    std::vector<std::shared_ptr<SlotChunk>> work_; // slots as the writer sees them
+    std::vector<bool> owned_;                      // work_[i] is not shared with root_ yet
+    size_t size_ = 0;
+    uint64_t seq_;
+    std::vector<uint64_t> slot_seq_;   // sequence of each slot's latest change
+    std::map<uint64_t, size_t> by_seq_; // slot_seq_ inverted, for delta reads
+    // Secondary indexes over the slots, maintained by upsert() for the query API.
+    std::unordered_map<std::string_view, OsBits> by_os_;
+    FleetStats stats_; // every asset
+    std::set<std::pair<std::string, size_t>> by_host_; // prefix filters are range scans
+    std::set<std::pair<long long, size_t>> by_ts_;     // parsable timestamps only
+    std::set<std::pair<long long, size_t>> by_ram_;    // numeric ram_mb only
+};
+
+// ------------------------------
+// record changes (heartbeats and deltas from agents)
+// ------------------------------
+// Besides full records, agents that remember what the server last acknowledged send
+//   {"op":"heartbeat","id":..,"hostname":..,"timestamp":..,"hash":h}
+//   {"op":"delta","id":..,"hostname":..,"timestamp":..,"base":h0,"hash":h,"set":{..},"unset":[..]}
+// id and hostname name the stored record the change applies to. Hashes are record_hash() of
+// the record before (base) and after (hash) the change; a heartbeat leaves everything but the
+// timestamp alone. The log keeps the change message itself and replays it on startup.
+struct RecordChange {
+    bool heartbeat = false;
+    std::string id, hostname;           // as in AssetRecord (string contents, still escaped)
+    std::string_view timestamp;         // raw JSON value
+    std::string_view base, hash;        // hex digests
+    std::vector<std::pair<std::string_view, std::string_view>> set; // key -> raw JSON value
+    std::vector<std::string_view> unset;
+};
+
+// FNV-1a over the record's top-level fields sorted by key, as "key=raw value\n" lines. The
+// timestamp is left out so a host that did not change keeps its hash.
+static std::string record_hash(std::string_view json) {
+    std::vector<std::pair<std::string_view, std::string_view>> fields;
+    if (!json_object_fields(json, fields)) return std::string();
+    std::sort(fields.begin(), fields.end());
+    uint64_t h = kFnvOffset;
+    for (const auto& f : fields) {
+        if (f.first == "timestamp") continue;
+        h = fnv1a64(fnv1a64(fnv1a64(fnv1a64(h, f.first), "="), f.second), "\n");
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+    return hex;
+}
+
+static bool json_string_contents(std::string_view raw, std::string_view* out) {
+    if (raw.size() < 2 || raw.front() != '"') return false;
+    *out = raw.substr(1, raw.size() - 2);
+    return true;
+}
+
+// Returns false (with *why) when `fields` (a parsed body carrying "op") is not a valid change.
+static bool parse_record_change(const std::vector<std::pair<std::string_view, std::string_view>>& fields,
+                                RecordChange& c, std::string* why) {
+    c = RecordChange{};
+    std::string_view op, id, hostname, set, unset;
+    for (const auto& f : fields) {
+        std::string_view* slot = f.first == "op" ? &op : f.first == "id" ? &id : f.first == "hostname" ? &hostname
+                               : f.first == "base" ? &c.base : f.first == "hash" ? &c.hash : nullptr;
+        if (slot && !json_string_contents(f.second, slot)) {
+            *why = "Field '" + std::string(f.first) + "' must be a string";
+            return false;
+        }
+        if (f.first == "timestamp") c.timestamp = f.second;
+        else if (f.first == "set") set = f.second;
+        else if (f.first == "unset") unset = f.second;
+    }
+    if (op != "heartbeat" && op != "delta") { *why = "Unknown op: " + std::string(op); return false; }
+    c.heartbeat = op == "heartbeat";
+    const char* missing = hostname.empty() ? "hostname" : c.timestamp.empty() ? "timestamp" : c.hash.empty() ? "hash"
+                        : !c.heartbeat && c.base.empty() ? "base" : nullptr;
+    if (missing) { *why = std::string("Missing required key: ") + missing; return false; }
+    if (c.timestamp.front() != '"') { *why = "Field 'timestamp' must be a string"; return false; }
+    if (c.heartbeat) c.base = c.hash;
+    c.id.assign(id.data(), id.size());
+    c.hostname.assign(hostname.data(), hostname.size());
+
+    if (!set.empty() && !json_object_fields(set, c.set)) { *why = "Field 'set' must be an object"; return false; }
+    if (!unset.empty()) {
+        const char* const end = unset.data() + unset.size();
+        const char* p = json_skip_ws(unset.data() + 1, end);
+        bool ok = unset.front() == '[';
+        while (ok && p < end && *p != ']') {
+            const char* q = *p == '"' ? json_scan_string(p + 1, end) : nullptr;
+            if (!q) { ok = false; break; }
+            c.unset.emplace_back(p + 1, (size_t)(q - p - 1));
+            p = json_skip_ws(q + 1, end);
+            if (p < end && *p == ',') p = json_skip_ws(p + 1, end);
+        }
+        if (!ok) { *why = "Field 'unset' must be an array of strings"; return false; }
+    }
+    for (const auto& k : c.unset) {
+        if (k == "id" || k == "timestamp") { *why = "A delta cannot unset '" + std::string(k) + "'"; return false; }
+    }
+    for (const auto& f : c.set) {
+        if (f.first == "id" || f.first == "timestamp") { *why = "A delta cannot set '" + std::string(f.first) + "'"; return false; }
+    }
+    return true;
+}
+
+// Applies `c` to `base` and leaves the new record in `merged`: base fields in their order with
+// the new timestamp, set/unset applied, new keys last. Returns 0, or 409 when there is no base
+// or it (or the result) does not hash as the agent expects; the agent then sends a full record.
+static int merge_record_change(const AssetRecord* base, const RecordChange& c, std::string& merged, std::string* why) {
+    if (!base) { *why = "Unknown asset; send the full record"; return 409; }
+    if (record_hash(base->json) != c.base) { *why = "Stored record does not match base hash; send the full record"; return 409; }
+    std::vector<std::pair<std::string_view, std::string_view>> fields;
+    json_object_fields(base->json, fields);
+    std::vector<bool> used(c.set.size());
+    merged.clear();
+    merged.reserve(base->json.size() + 64);
+    auto put = [&](std::string_view k, std::string_view v) {
+        merged += merged.empty() ? "{\"" : ",\"";
+        merged += k; merged += "\":"; merged += v;
+    };
+    for (const auto& f : fields) {
+        if (f.first == "timestamp") { put(f.first, c.timestamp); continue; }
+        if (std::find(c.unset.begin(), c.unset.end(), f.first) != c.unset.end()) continue;
+        std::string_view v = f.second;
+        for (size_t i = 0; i < c.set.size(); i++) {
+            if (c.set[i].first == f.first) { v = c.set[i].second; used[i] = true; }
+        }
+        put(f.first, v);
+    }
+    for (size_t i = 0; i < c.set.size(); i++) if (!used[i]) put(c.set[i].first, c.set[i].second);
+    merged += merged.empty() ? "{}" : "}";
+    if (record_hash(merged) != c.hash) { *why = "Merged record does not match hash; send the full record"; return 409; }
+    return 0;
+}
+
+// Why the storage writer refused a change (see StorageWriter): its base was replaced meanwhile.
+static const char* const kStaleChange = "Stored record changed before the change was written; send the full record";
+
+// Records a change resolves against that are not in the store yet (earlier items of one batch).
+using PendingRecords = std::unordered_map<std::string, std::shared_ptr<const AssetRecord>>;
+
+// Turns a posted body (or a log line) into the record to store. Full records are taken as they
+// are; change messages are merged onto the current record for their key, looked up in `pending`
+// first. Returns 0, or the status to refuse with (400 invalid, 409 base unknown or stale) and
+// *why. *change tells whether `body` was a change message; *base_out, when given, gets the
+// record a change was merged onto (null for a full record).
+//
+// With `defer_key`, a change gets its key there and is only merged onto `pending`: when its key
+// is not in it, 0 is returned with `out` empty, for a caller that cannot trust the store yet.
+static int resolve_record(const AssetStore& store, std::string_view body, std::shared_ptr<const AssetRecord>& out,
+                          bool* change, std::string* why, const PendingRecords* pending = nullptr,
+                          std::string* defer_key = nullptr, std::shared_ptr<const AssetRecord>* base_out = nullptr) {
+    AssetView v;
+    *change = false;
+    if (base_out) base_out->reset();
+    if (parse_asset_json(body, v, why)) {
+        out = store.make_record(body, v);
+        return 0;
+    }
+    std::vector<std::pair<std::string_view, std::string_view>> fields;
+    if (!json_object_fields(body, fields) ||
+        std::none_of(fields.begin(), fields.end(), [](const auto& f) { return f.first == "op"; })) {
+        return 400; // not a change message: keep the record validation error
+    }
+    *change = true;
+    RecordChange c;
+    if (!parse_record_change(fields, c, why)) return 400;
+    const std::string key = store.key_of(c.id, c.hostname);
+    std::shared_ptr<const AssetRecord> base;
+    if (pending) {
+        auto it = pending->find(key);
+        if (it != pending->end()) base = it->second;
+    }
+    if (defer_key) {
+        *defer_key = key;
+        if (!base) { out.reset(); return 0; }
+    }
+    if (!base) base = store.find(key);
+    std::string merged;
+    if (const int code = merge_record_change(base.get(), c, merged, why)) return code;
+    if (!parse_asset_json(merged, v, why)) return 400;
+    out = store.make_record(merged, v);
+    if (base_out) *base_out = std::move(base);
+    return 0;
+}
+
+// ------------------------------
+// storage backends (JSONL log, columnar segments)
+// ------------------------------
+static bool sync_file(std::FILE* f) {
+    if (std::fflush(f) != 0) return false;
+#if defined(_WIN32)
+    return _commit(_fileno(f)) == 0;
+#elif defined(__linux__)
+    return fdatasync(fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+// Makes creations and renames in the directory holding `path` durable (no-op on Windows).
+static void sync_dir(const std::string& path) {
+#if !defined(_WIN32)
+    const std::string dir = std::filesystem::path(path).parent_path().string();
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (fd >= 0) { fsync(fd); close(fd); }
+#else
+    (void)path;
+#endif
+}
+
+// Where accepted records end up on disk. Only the storage writer thread calls append().
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+    virtual bool open(const std::string& path) = 0;
+    // Appends the batch; when `sync` is set it must be durable on return. A non-empty lines[i]
+    // is the change message batch[i] was merged from, for backends that log what was posted.
+    virtual bool append(const std::vector<std::shared_ptr<const AssetRecord>>& batch,
+                        const std::vector<std::string_view>& lines, bool sync) = 0;
+    // Log compaction support: bytes in the active log, and closing it as a numbered segment
+    // (returns the segment number, 0 when not supported or it failed).
+    virtual uint64_t active_bytes() const { return 0; }
+    virtual uint64_t rotate() { return 0; }
+};
+
+// Compacted JSONL layout, next to the active log <db>:
+//   <db>.seg.<n>   closed log segments, oldest first
+//   <db>.snap.<n>  latest record per asset as of segment n (covers every segment <= n)
+// Recovery loads the newest snapshot, the segments after it, then <db> itself.
+static std::string jsonl_segment_path(const std::string& db, uint64_t n) { return db + ".seg." + std::to_string(n); }
+static std::string jsonl_snapshot_path(const std::string& db, uint64_t n) { return db + ".snap." + std::to_string(n); }
+
+struct JsonlChain {
+    std::vector<std::string> files; // in replay order
+    std::vector<std::string> stale; // covered by the snapshot, or left over by an interrupted compaction
+    uint64_t snapshot = 0;          // number of the snapshot in use, 0 for none
+    size_t segments = 0;            // segments replayed after it
+    uint64_t max_no = 0;            // highest segment/snapshot number seen
+};
+
+static JsonlChain scan_jsonl_chain(const std::string& db) {
+    JsonlChain c;
+    const std::filesystem::path dbp(db);
+    const std::filesystem::path dir = dbp.parent_path().empty() ? std::filesystem::path(".") : dbp.parent_path();
+    const std::string base = dbp.filename().string();
+    std::vector<uint64_t> segs, snaps;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        if (name.compare(0, base.size(), base) != 0) continue;
+        const std::string rest = name.substr(base.size());
+        const bool seg = rest.rfind(".seg.", 0) == 0, snap = rest.rfind(".snap.", 0) == 0;
+        if (!seg && !snap) continue;
+        const std::string num = rest.substr(seg ? 5 : 6);
+        unsigned long long n;
+        if (!parse_uint(num, ULLONG_MAX, &n) || n == 0) {
+            if (snap && num.size() > 4 && num.compare(num.size() - 4, 4, ".tmp") == 0) c.stale.push_back(it->path().string());
+            continue;
+        }
+        (seg ? segs : snaps).push_back(n);
+        c.max_no = std::max<uint64_t>(c.max_no, n);
+    }
+    std::sort(segs.begin(), segs.end());
+    std::sort(snaps.begin(), snaps.end());
+    if (!snaps.empty()) {
+        c.snapshot = snaps.back();
+        c.files.push_back(jsonl_snapshot_path(db, c.snapshot));
+        for (size_t i = 0; i + 1 < snaps.size(); i++) c.stale.push_back(jsonl_snapshot_path(db, snaps[i]));
+    }
+    for (uint64_t n : segs) {
+        if (n <= c.snapshot) c.stale.push_back(jsonl_segment_path(db, n));
+        else { c.files.push_back(jsonl_segment_path(db, n)); c.segments++; }
+    }
+    c.files.push_back(db);
+    return c;
+}
+
+class JsonlBackend : public StorageBackend {
+public:
+    ~JsonlBackend() override { if (f_) std::fclose(f_); }
+
+    bool open(const std::string& path) override {
+        path_ = path;
+        next_segment_ = scan_jsonl_chain(path).max_no + 1;
+        f_ = std::fopen(path.c_str(), "ab");
+        if (!f_) { log_err("Cannot open DB file for append: " + path); return false; }
+        std::error_code ec;
+        bytes_ = std::filesystem::file_size(path, ec);
+        if (ec) bytes_ = 0;
+        return true;
+    }
+
+    uint64_t active_bytes() const override { return bytes_; }
+
+    uint64_t rotate() override {
+        std::fclose(f_);
+        const uint64_t n = next_segment_;
+        std::error_code ec;
+        std::filesystem::rename(path_, jsonl_segment_path(path_, n), ec);
+        if (!ec) { next_segment_++; bytes_ = 0; sync_dir(path_); }
+        else log_err("Cannot rotate " + path_ + ": " + ec.message());
+        f_ = std::fopen(path_.c_str(), "ab");
+        if (!f_) { log_err("Cannot open DB file for append: " + path_); return 0; }
+        return ec ? 0 : n;
+    }
+
+    bool append(const std::vector<std::shared_ptr<const AssetRecord>>& batch,
+                const std::vector<std::string_view>& lines, bool sync) override {
+        auto line = [&](size_t i) -> std::string_view {
+            return i < lines.size() && !lines[i].empty() ? lines[i] : std::string_view(batch[i]->json);
+        };
+        size_t total = 0;
+        for (size_t i = 0; i < batch.size(); i++) total += line(i).size() + 1;
+        buf_.clear();
+        buf_.reserve(total);
+        for (size_t i = 0; i < batch.size(); i++) { buf_ += line(i); buf_ += '\n'; }
+
+        if (!f_) return false;
+        if (std::fwrite(buf_.data(), 1, buf_.size(), f_) != buf_.size()) { std::clearerr(f_); return false; }
+        bytes_ += buf_.size();
+        return sync ? sync_file(f_) : std::fflush(f_) == 0;
+    }
+
+private:
+    std::string path_;
+    std::FILE* f_ = nullptr;
+    std::string buf_;
+    uint64_t bytes_ = 0;
+    uint64_t next_segment_ = 1;
+};
+
+// Read-only view of a whole file (mmap / MapViewOfFile). Empty files map to size 0.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { unmap(); }
+
+    bool map(const std::string& path) {
+        unmap();
+#if defined(_WIN32)
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz{};
+        if (!GetFileSizeEx(file_, &sz)) return false;
+        size_ = (size_t)sz.QuadPart;
+        if (size_ == 0) return true;
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping_) return false;
+        data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        return data_ != nullptr;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st{};
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        size_ = (size_t)st.st_size;
+        if (size_ > 0) {
+            void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) { ::close(fd); size_ = 0; return false; }
+            data_ = (const char*)p;
+        }
+        ::close(fd);
+        return true;
+#endif
+    }
+
+    void unmap() {
+#if defined(_WIN32)
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = NULL;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) munmap((void*)data_, size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+#if defined(_WIN32)
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#endif
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Startup load progress, for the readiness endpoint and /metrics. `total` and `done` count
+// bytes of JSONL or rows of a columnar DB.
+struct LoadProgress {
+    std::atomic<uint64_t> total{0}, done{0};
+    std::atomic<bool> ready{false};
+    std::atomic<uint64_t> ready_ms{0}; // from process start until ready
+
+    double ratio() const {
+        const uint64_t t = total.load(std::memory_order_relaxed);
+        return ready.load(std::memory_order_acquire) || t == 0 ? 1.0
+             : std::min(1.0, (double)done.load(std::memory_order_relaxed) / (double)t);
+    }
+};
+
+// What one worker makes of one slice of a JSONL file: the newest record per key in the slice,
+// plus, for keys whose first line there is a change, the changes themselves (their base is in
+// an earlier slice, which has not been applied yet).
+struct LoadChunk {
+    std::string_view text;
+    PendingRecords latest;
+    std::unordered_map<std::string, std::vector<std::string_view>> deferred;
+    std::vector<std::string> order; // keys in first-seen order, so slots come out as a serial replay's
+    size_t lines = 0, bad = 0;
+};
+
+static void parse_load_chunk(const AssetStore& store, LoadChunk& ch, LoadProgress* progress) {
+    std::string why, key;
+    std::shared_ptr<const AssetRecord> rec;
+    bool change;
+    size_t pos = 0, reported = 0;
+    while (pos < ch.text.size()) {
+        size_t eol = ch.text.find('\n', pos);
+        if (eol == std::string_view::npos) eol = ch.text.size();
+        std::string_view line = ch.text.substr(pos, eol - pos);
+        pos = eol < ch.text.size() ? eol + 1 : eol;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
+        ch.lines++;
+        const int code = resolve_record(store, line, rec, &change, &why, &ch.latest, &key);
+        if (code == 400) ch.bad++;
+        if (code) continue;
+        if (!change) key = store.key_of(rec->id, rec->hostname);
+        if (!ch.latest.count(key) && !ch.deferred.count(key)) ch.order.push_back(key);
+        if (rec) {
+            ch.latest[key] = std::move(rec);
+            ch.deferred.erase(key);
+        } else {
+            ch.deferred[key].push_back(line);
+        }
+        if (progress && pos - reported >= (1u << 20)) {
+            progress->done += pos - reported;
+            reported = pos;
+        }
+    }
+    if (progress) progress->done += pos - reported;
+}
+
+// Replays one JSONL file into the store (startup only). The mapped file is cut at line
+// boundaries into slices that `threads` workers parse at once; the slices are then applied in
+// file order, each key's deferred changes against the store and then its newest record, which
+// leaves the store as a line-by-line replay would. Returns lines read; lines that fail
+// validation are counted in *bad. Changes whose base is not current are skipped without
+// counting: after a compaction the snapshot can already hold their result.
+static size_t load_jsonl_file(AssetStore& store, const std::string& path, size_t* bad, unsigned threads,
+                              LoadProgress* progress) {
+    MappedFile file;
+    if (!file.map(path) || file.size() == 0) return 0;
+    const std::string_view text(file.data(), file.size());
+    static const size_t kMinSlice = 4u << 20;
+    const size_t slices = std::max<size_t>(1, std::min<size_t>((size_t)threads * 4, text.size() / kMinSlice));
+    std::vector<LoadChunk> chunks(slices);
+    for (size_t i = 0, from = 0; i < slices; i++) {
+        size_t to = text.size();
+        if (i + 1 < slices) {
+            to = text.find('\n', std::max(from, text.size() / slices * (i + 1)));
+            to = to == std::string_view::npos ? text.size() : to + 1;
+        }
+        chunks[i].text = text.substr(from, to - from);
+        from = to;
+    }
+
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < chunks.size();) parse_load_chunk(store, chunks[i], progress);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < slices; t++) pool.emplace_back(work);
+    work();
+    for (auto& t : pool) t.join();
+
+    size_t lines = 0;
+    std::string why;
+    std::shared_ptr<const AssetRecord> rec;
+    bool change;
+    for (LoadChunk& ch : chunks) {
+        lines += ch.lines;
+        if (bad) *bad += ch.bad;
+        for (const std::string& key : ch.order) {
+            auto d = ch.deferred.find(key);
+            if (d != ch.deferred.end()) {
+                for (std::string_view line : d->second) {
+                    const int code = resolve_record(store, line, rec, &change, &why);
+                    if (code == 0) store.upsert(std::move(rec));
+                    else if (code == 400 && bad) (*bad)++;
+                }
+            }
+            auto l = ch.latest.find(key);
+            if (l != ch.latest.end()) store.upsert(std::move(l->second));
+        }
+        ch = LoadChunk(); // its records now live in the store alone
+    }
+    return lines;
+}
+
+// Startup recovery for JSONL: newest snapshot, the segments after it, then the active log.
+// Files the snapshot already covers are removed. Returns lines read.
+static size_t load_jsonl_db(AssetStore& store, const std::string& db, size_t* bad, unsigned threads,
+                            LoadProgress* progress) {
+    const JsonlChain c = scan_jsonl_chain(db);
+    if (progress) {
+        std::error_code ec;
+        for (const auto& f : c.files) {
+            const uintmax_t n = std::filesystem::file_size(f, ec);
+            if (!ec) progress->total += n;
+        }
+    }
+    size_t lines = 0;
+    for (const auto& f : c.files) lines += load_jsonl_file(store, f, bad, threads, progress);
+    store.publish();
+    if (c.snapshot) {
+        log_info("Recovered from " + jsonl_snapshot_path(db, c.snapshot) + " + " + std::to_string(c.segments) + " segment(s) + " + db);
+    }
+    std::error_code ec;
+    for (const auto& f : c.stale) std::filesystem::remove(f, ec);
+    return lines;
+}
+
+// Columnar layout: a directory of append-only column files.
+//   meta                        magic + committed sizes of every file (the commit point)
+//   cpu_cores.i32  ram_mb.i64   -1 = "N/A", INT64_MIN / INT32_MIN = absent
+//   ts.i64  tz.i16              epoch seconds (wall clock as UTC) + offset minutes
+//   ip.bin                      1 family byte (0 "N/A", 4, 6, 255 other) + 16 address bytes
+//   os.u32  hostname.u32        codes into os.dict / hostname.dict (u32 length + bytes per entry)
+//   id.off/id.dat               u64 end offsets + bytes
+//   extra.off/extra.dat         original JSON, only for rows the columns cannot reproduce
+//                               byte-for-byte (unknown keys, other formatting)
+struct ColumnarMeta {
+    char magic[8];
+    uint64_t rows;
+    uint64_t os_dict_bytes, host_dict_bytes;
+    uint64_t id_bytes, extra_bytes;
+};
+static const char kColumnarMagic[8] = {'A','I','C','O','L','0','0','1'};
+static const size_t kIpWidth = 17;
+
+static bool read_columnar_meta(const std::string& dir, ColumnarMeta& m) {
+    std::FILE* f = std::fopen((dir + "/meta").c_str(), "rb");
+    if (!f) return false;
+    const bool ok = std::fread(&m, sizeof(m), 1, f) == 1 && std::memcmp(m.magic, kColumnarMagic, 8) == 0;
+    std::fclose(f);
+    return ok;
+}
+
+static void encode_ip(std::string_view text, unsigned char out[kIpWidth]) {
+    std::memset(out, 0, kIpWidth);
+    if (text == "N/A") return;
+    const std::string s(text);
+    if (inet_pton(AF_INET, s.c_str(), out + 1) == 1) { out[0] = 4; return; }
+    if (inet_pton(AF_INET6, s.c_str(), out + 1) == 1) { out[0] = 6; return; }
+    out[0] = 255;
+}
+
+static std::string decode_ip(const unsigned char* in) {
+    char buf[INET6_ADDRSTRLEN] = {0};
+    if (in[0] == 4 && inet_ntop(AF_INET, (void*)(in + 1), buf, sizeof(buf))) return buf;
+    if (in[0] == 6 && inet_ntop(AF_INET6, (void*)(in + 1), buf, sizeof(buf))) return buf;
+    return in[0] == 0 ? "N/A" : "";
+}
+
+// Field values of one columnar row, and the canonical JSON they stand for (same key order
+// and formatting as build_asset_json(), so records with only the core fields round-trip
+// without `extra`).
+struct ColumnarRow {
+    std::string id, hostname, os, ip, timestamp;
+    int32_t cpu_cores = INT32_MIN;
+    int64_t ram_mb = INT64_MIN;
+
+    std::string to_json() const {
+        std::string j = "{\"id\":\"" + id + "\",\"hostname\":\"" + hostname + "\",\"os\":\"" + os + "\",";
+        if (cpu_cores != INT32_MIN) j += "\"cpu_cores\":" + std::to_string(cpu_cores) + ",";
+        if (ram_mb == -1) j += "\"ram_mb\":\"N/A\",";
+        else if (ram_mb != INT64_MIN) j += "\"ram_mb\":" + std::to_string((long long)ram_mb) + ",";
+        j += "\"ip\":\"" + ip + "\",\"timestamp\":\"" + timestamp + "\"}";
+        return j;
+    }
+};
+
+class ColumnarBackend : public StorageBackend {
+public:
+    ~ColumnarBackend() override { close_files(); }
+
+    bool open(const std::string& dir) override {
+        dir_ = dir;
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (!read_columnar_meta(dir, meta_)) {
+            std::memset(&meta_, 0, sizeof(meta_));
+            std::memcpy(meta_.magic, kColumnarMagic, 8);
+        }
+        // Drop anything a crash left behind past the last committed batch.
+        const uint64_t r = meta_.rows;
+        const std::pair<const char*, uint64_t> sizes[] = {
+            {"cpu_cores.i32", r * 4}, {"ram_mb.i64", r * 8}, {"ts.i64", r * 8}, {"tz.i16", r * 2},
+            {"ip.bin", r * kIpWidth}, {"os.u32", r * 4}, {"hostname.u32", r * 4},
+            {"os.dict", meta_.os_dict_bytes}, {"hostname.dict", meta_.host_dict_bytes},
+            {"id.off", r * 8}, {"id.dat", meta_.id_bytes}, {"extra.off", r * 8}, {"extra.dat", meta_.extra_bytes},
+        };
+        for (const auto& fs : sizes) {
+            const std::string p = dir + "/" + fs.first;
+            if (!std::filesystem::exists(p)) { std::FILE* f = std::fopen(p.c_str(), "ab"); if (f) std::fclose(f); }
+            std::filesystem::resize_file(p, fs.second, ec);
+            if (ec) { log_err("Cannot prepare column file " + p + ": " + ec.message()); return false; }
+        }
+        if (!load_dict("os.dict", os_dict_) || !load_dict("hostname.dict", host_dict_)) return false;
+
+        const char* names[kFiles] = {"cpu_cores.i32", "ram_mb.i64", "ts.i64", "tz.i16", "ip.bin", "os.u32", "hostname.u32",
+                                     "os.dict", "hostname.dict", "id.off", "id.dat", "extra.off", "extra.dat"};
+        for (int i = 0; i < kFiles; i++) {
+            files_[i] = std::fopen((dir + "/" + names[i]).c_str(), "ab");
+            if (!files_[i]) { log_err(std::string("Cannot open column file ") + names[i]); return false; }
+        }
+        return write_meta(false);
+    }
+
+    // Columns hold the merged records; change messages are not kept.
+    bool append(const std::vector<std::shared_ptr<const AssetRecord>>& batch,
+                const std::vector<std::string_view>&, bool sync) override {
+        for (const auto& rec : batch) {
+            ColumnarRow row;
+            row.id = rec->id;
+            row.hostname = rec->hostname;
+            row.os = rec->os;
+            row.ip = rec->ip;
+            row.timestamp = rec->timestamp;
+            row.cpu_cores = rec->cpu_cores.empty() ? INT32_MIN : (int32_t)rec->cpu_cores_num;
+            row.ram_mb = rec->ram_mb == "N/A" ? -1 : rec->ram_mb.empty() ? INT64_MIN : (int64_t)rec->ram_mb_num;
+
+            long long ts = INT64_MIN;
+            int16_t tz = kTzNone;
+            if (!parse_iso8601(rec->timestamp, &ts, &tz)) ts = INT64_MIN;
+            unsigned char ip[kIpWidth];
+            encode_ip(rec->ip, ip);
+            const uint32_t os_code = code_for(os_dict_, std::string(rec->os), F_OS_DICT, meta_.os_dict_bytes);
+            const uint32_t host_code = code_for(host_dict_, std::string(rec->hostname), F_HOST_DICT, meta_.host_dict_bytes);
+
+            // Keep the original text only if the columns would not give it back unchanged.
+            bool exact = ts != INT64_MIN && ip[0] != 255;
+            if (exact) {
+                row.timestamp = format_iso8601(ts, tz);
+                row.ip = decode_ip(ip);
+                exact = row.to_json() == rec->json;
+            }
+
+            const int64_t ram = row.ram_mb;
+            const int64_t ts64 = ts;
+            put(F_CPU, &row.cpu_cores, 4);
+            put(F_RAM, &ram, 8);
+            put(F_TS, &ts64, 8);
+            put(F_TZ, &tz, 2);
+            put(F_IP, ip, kIpWidth);
+            put(F_OS, &os_code, 4);
+            put(F_HOST, &host_code, 4);
+            put(F_ID_DAT, rec->id.data(), rec->id.size());
+            meta_.id_bytes += rec->id.size();
+            put(F_ID_OFF, &meta_.id_bytes, 8);
+            if (!exact) {
+                put(F_EXTRA_DAT, rec->json.data(), rec->json.size());
+                meta_.extra_bytes += rec->json.size();
+            }
+            put(F_EXTRA_OFF, &meta_.extra_bytes, 8);
+            meta_.rows++;
+        }
+        if (!ok_) return false;
+        for (auto* f : files_) {
+            if (!(sync ? sync_file(f) : std::fflush(f) == 0)) return false;
+        }
+        return write_meta(sync);
+    }
+
+private:
+    enum { F_CPU, F_RAM, F_TS, F_TZ, F_IP, F_OS, F_HOST, F_OS_DICT, F_HOST_DICT, F_ID_OFF, F_ID_DAT, F_EXTRA_OFF, F_EXTRA_DAT, kFiles };
+
+    void put(int f, const void* p, size_t n) {
+        if (n && std::fwrite(p, 1, n, files_[f]) != n) ok_ = false;
+    }
+
+    uint32_t code_for(std::unordered_map<std::string, uint32_t>& dict, const std::string& s, int file, uint64_t& bytes) {
+        auto it = dict.find(s);
+        if (it != dict.end()) return it->second;
+        const uint32_t code = (uint32_t)dict.size();
+        const uint32_t len = (uint32_t)s.size();
+        put(file, &len, 4);
+        put(file, s.data(), s.size());
+        bytes += 4 + s.size();
+        dict.emplace(s, code);
+        return code;
+    }
+
+    bool load_dict(const char* name, std::unordered_map<std::string, uint32_t>& dict) {
+        MappedFile mf;
+        if (!mf.map(dir_ + "/" + name)) { log_err(std::string("Cannot map ") + name); return false; }
+        size_t pos = 0;
+        while (pos + 4 <= mf.size()) {
+            uint32_t len;
+            std::memcpy(&len, mf.data() + pos, 4);
+            if (pos + 4 + len > mf.size()) break;
+            dict.emplace(std::string(mf.data() + pos + 4, len), (uint32_t)dict.size());
+            pos += 4 + len;
+        }
+        return true;
+    }
+
+    // The meta file is the commit point: rows past meta.rows are ignored (and trimmed) on open.
+    bool write_meta(bool sync) {
+        const std::string tmp = dir_ + "/meta.tmp";
+        std::FILE* f = std::fopen(tmp.c_str(), "wb");
+        if (!f) return false;
+        bool ok = std::fwrite(&meta_, sizeof(meta_), 1, f) == 1 && (sync ? sync_file(f) : std::fflush(f) == 0);
+        std::fclose(f);
+        std::error_code ec;
+        if (ok) std::filesystem::rename(tmp, dir_ + "/meta", ec);
+        return ok && !ec;
+    }
+
+    void close_files() {
+        for (auto*& f : files_) { if (f) std::fclose(f); f = nullptr; }
+    }
+
+    std::string dir_;
+    ColumnarMeta meta_{};
+    std::FILE* files_[kFiles] = {};
+    bool ok_ = true;
+    std::unordered_map<std::string, uint32_t> os_dict_, host_dict_;
+};
+
+// mmap-based reader over the committed rows of a columnar directory.
+class ColumnarReader {
+public:
+    bool open(const std::string& dir) {
+        if (!read_columnar_meta(dir, meta_)) return false;
+        const char* names[kCols] = {"cpu_cores.i32", "ram_mb.i64", "ts.i64", "tz.i16", "ip.bin", "os.u32", "hostname.u32",
+                                    "os.dict", "hostname.dict", "id.off", "id.dat", "extra.off", "extra.dat"};
+        for (int i = 0; i < kCols; i++) {
+            if (!cols_[i].map(dir + "/" + names[i])) return false;
+        }
+        const uint64_t r = meta_.rows;
+        if (cols_[0].size() < r * 4 || cols_[1].size() < r * 8 || cols_[2].size() < r * 8 || cols_[3].size() < r * 2 ||
+            cols_[4].size() < r * kIpWidth || cols_[5].size() < r * 4 || cols_[6].size() < r * 4 ||
+            cols_[9].size() < r * 8 || cols_[11].size() < r * 8) return false;
+        read_dict(cols_[7], meta_.os_dict_bytes, os_);
+        read_dict(cols_[8], meta_.host_dict_bytes, hosts_);
+        return true;
+    }
+
+    size_t rows() const { return (size_t)meta_.rows; }
+
+    // Original JSON for rows stored with `extra`, empty otherwise.
+    std::string_view extra(size_t i) const { return heap(12, 11, i); }
+
+    ColumnarRow row(size_t i) const {
+        ColumnarRow r;
+        r.cpu_cores = at<int32_t>(0, i);
+        r.ram_mb = at<int64_t>(1, i);
+        r.timestamp = format_iso8601(at<int64_t>(2, i), at<int16_t>(3, i));
+        r.ip = decode_ip((const unsigned char*)cols_[4].data() + i * kIpWidth);
+        const uint32_t oc = at<uint32_t>(5, i), hc = at<uint32_t>(6, i);
+        if (oc < os_.size()) r.os = std::string(os_[oc]);
+        if (hc < hosts_.size()) r.hostname = std::string(hosts_[hc]);
+        r.id = std::string(heap(10, 9, i));
+        return r;
+    }
+
+private:
+    enum { kCols = 13 };
+
+    template <typename T> T at(int col, size_t i) const {
+        T v;
+        std::memcpy(&v, cols_[col].data() + i * sizeof(T), sizeof(T));
+        return v;
+    }
+
+    std::string_view heap(int dat, int off, size_t i) const {
+        const uint64_t end = at<uint64_t>(off, i);
+        const uint64_t begin = i ? at<uint64_t>(off, i - 1) : 0;
+        if (end < begin || end > cols_[dat].size()) return std::string_view();
+        return std::string_view(cols_[dat].data() + begin, (size_t)(end - begin));
+    }
+
+    static void read_dict(const MappedFile& mf, uint64_t limit, std::vector<std::string_view>& out) {
+        size_t pos = 0;
+        const size_t end = std::min<size_t>(mf.size(), (size_t)limit);
+        while (pos + 4 <= end) {
+            uint32_t len;
+            std::memcpy(&len, mf.data() + pos, 4);
+            if (pos + 4 + len > end) break;
+            out.emplace_back(mf.data() + pos + 4, len);
+            pos += 4 + len;
+        }
+    }
+
+    ColumnarMeta meta_{};
+    MappedFile cols_[kCols];
+    std::vector<std::string_view> os_, hosts_;
+};
+
+// Turns row i into an index record. Rows with `extra` go through the JSON parser; all others
+// are rebuilt from the columns alone.
+static std::shared_ptr<const AssetRecord> columnar_record(const AssetStore& store, const ColumnarReader& rd, size_t i) {
+    const std::string_view extra = rd.extra(i);
+    AssetView v;
+    if (!extra.empty()) {
+        if (!parse_asset_json(extra, v, nullptr)) return nullptr;
+        return store.make_record(extra, v);
+    }
+    const ColumnarRow row = rd.row(i);
+    std::string cpu, ram;
+    v.id = row.id;
+    v.hostname = row.hostname;
+    v.os = row.os;
+    v.ip = row.ip;
+    v.timestamp = row.timestamp;
+    if (row.cpu_cores != INT32_MIN) { cpu = std::to_string(row.cpu_cores); v.cpu_cores = cpu; v.cpu_cores_num = row.cpu_cores; }
+    if (row.ram_mb == -1) v.ram_mb = "N/A";
+    else if (row.ram_mb != INT64_MIN) { ram = std::to_string((long long)row.ram_mb); v.ram_mb = ram; v.ram_mb_num = row.ram_mb; }
+    return store.make_record(row.to_json(), v);
+}
+
+// Startup load for --db-format columnar: reads the mapped columns, no JSON parsing for
+// ordinary rows. Returns rows read; rows that cannot be rebuilt are counted in *bad.
+static size_t load_columnar(AssetStore& store, const std::string& dir, size_t* bad, LoadProgress* progress) {
+    ColumnarReader rd;
+    if (!rd.open(dir)) return 0;
+    if (progress) progress->total = rd.rows();
+    for (size_t i = 0; i < rd.rows(); i++) {
+        auto rec = columnar_record(store, rd, i);
+        if (rec) store.upsert(std::move(rec));
+        else if (bad) (*bad)++;
+        if (progress && (i & 0xffff) == 0xffff) progress->done = i + 1;
+    }
+    if (progress) progress->done = rd.rows();
+    store.publish();
+    return rd.rows();
+}
+
+// jsonl <-> columnar conversion (every row is kept; the index collapses them on load).
+static int convert_db(const std::string& from, const std::string& to, const std::string& to_format) {
+    size_t rows = 0, bad = 0;
+    if (to_format == "columnar") {
+        ColumnarBackend out;
+        if (!out.open(to)) return 1;
+        if (!std::filesystem::exists(from)) { log_err("Cannot open " + from); return 1; }
+        std::vector<std::shared_ptr<const AssetRecord>> batch;
+        std::string line, why;
+        std::shared_ptr<const AssetRecord> rec;
+        bool change;
+        AssetStore replay; // change lines are merged onto the record they were sent against
+        auto flush = [&]() {
+            if (!batch.empty() && !out.append(batch, {}, false)) return false;
+            batch.clear();
+            return true;
+        };
+        for (const auto& file : scan_jsonl_chain(from).files) { // snapshot + segments + active log
+            std::ifstream in(file);
+            while (std::getline(in, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                const int code = resolve_record(replay, line, rec, &change, &why);
+                if (code == 400) bad++;
+                if (code) continue;
+                replay.upsert(rec);
+                batch.push_back(std::move(rec));
+                rows++;
+                if (batch.size() >= 4096 && !flush()) { log_err("Write failed: " + to); return 1; }
+            }
+        }
+        if (!flush() || !out.append({}, {}, true)) { log_err("Write failed: " + to); return 1; }
+    } else if (to_format == "jsonl") {
+        ColumnarReader rd;
+        if (!rd.open(from)) { log_err("Not a columnar DB: " + from); return 1; }
+        std::ofstream out(to, std::ios::binary | std::ios::trunc);
+        if (!out) { log_err("Cannot create " + to); return 1; }
+        for (size_t i = 0; i < rd.rows(); i++) {
+            const std::string_view extra = rd.extra(i);
+            if (!extra.empty()) out.write(extra.data(), (std::streamsize)extra.size());
+            else out << rd.row(i).to_json();
+            out << '\n';
+            rows++;
+        }
+        if (!out.flush()) { log_err("Write failed: " + to); return 1; }
+    } else {
+        log_err("Unknown --to-format: " + to_format);
+        return 2;
+    }
+    log_info("Converted " + std::to_string(rows) + " row(s) " + from + " -> " + to + (bad ? " (" + std::to_string(bad) + " invalid line(s) skipped)" : ""));
+    return 0;
+}
+
+// ------------------------------
+// JSONL log compaction
+// ------------------------------
+// Writes snapshots in the background. The storage writer rotates the active log into segment n
+// (a rename, between batches) and hands n over; the snapshot is then dumped from the in-memory
+// index page by page, so ingest never waits for it. The index already holds everything in
+// segments <= n, and any newer records it also contains are replayed again from later
+// segments on recovery, which ends in the same state.
+class Compactor {
+public:
+    void start(const std::string& db, const AssetStore* store) {
+        db_ = db;
+        store_ = store;
+        std::thread([this]{ run(); }).detach();
+    }
+
+    bool busy() const { return busy_.load(); }
+
+    void request(uint64_t segment) {
+        busy_ = true;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            pending_ = segment;
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            uint64_t n;
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait(lk, [&]{ return pending_ != 0; });
+                n = pending_;
+                pending_ = 0;
+            }
+            compact(n);
+            busy_ = false;
+        }
+    }
+
+    void compact(uint64_t n) {
+        const auto t0 = std::chrono::steady_clock::now();
+        const std::string snap = jsonl_snapshot_path(db_, n), tmp = snap + ".tmp";
+        std::FILE* f = std::fopen(tmp.c_str(), "wb");
+        if (!f) { log_err("Cannot create " + tmp); return; }
+
+        std::vector<std::shared_ptr<const AssetRecord>> page;
+        std::string buf;
+        size_t assets = 0, bytes = 0;
+        bool ok = true;
+        const auto root = store_->snapshot();
+        for (size_t got; ok && (got = AssetStore::read_range(*root, assets, 1024, page)) > 0; page.clear()) {
+            buf.clear();
+            for (const auto& r : page) { buf += r->json; buf += '\n'; }
+            ok = std::fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+            assets += got;
+            bytes += buf.size();
+        }
+        ok = sync_file(f) && ok;
+        std::fclose(f);
+        std::error_code ec;
+        if (ok) std::filesystem::rename(tmp, snap, ec);
+        if (!ok || ec) {
+            log_err("Compaction failed writing " + snap);
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+        sync_dir(snap);
+
+        const JsonlChain c = scan_jsonl_chain(db_);
+        for (const auto& stale : c.stale) std::filesystem::remove(stale, ec);
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        log_info("Compacted " + db_ + " through segment " + std::to_string(n) + ": " + std::to_string(assets) + " asset(s), " +
+                 std::to_string(bytes) + " bytes in " + std::to_string((long long)ms) + "ms");
+    }
+
+    std::string db_;
+    const AssetStore* store_ = nullptr;
+    std::atomic<bool> busy_{false};
+    std::mutex mu_;
+    std::condition_variable cv_;
+    uint64_t pending_ = 0;
+};
+
+// ------------------------------
+// heap accounting
+// ------------------------------
+// With ASSET_HEAP_COUNT (make HEAP_COUNT=1) every operator new is counted, so /metrics (and the
+// bench, which reads it) can show how many allocations a request costs. Production builds keep
+// the library allocator untouched.
+#if defined(ASSET_HEAP_COUNT)
+// Each thread counts in a cache line of its own, leased from a fixed pool (leasing must not
+// allocate); only the owner writes it, so the hot path has no shared read-modify-write. A cell
+// keeps its count when its thread exits and the next thread carries on from there.
+struct alignas(64) HeapCell {
+    std::atomic<uint64_t> n{0};
+    std::atomic<bool> used{false};
+};
+static const size_t kHeapCells = 1024;
+static HeapCell g_heap_cells[kHeapCells];
+static std::atomic<uint64_t> g_heap_overflow{0}; // threads that found every cell taken
+
+struct HeapCellLease {
+    HeapCell* cell = nullptr;
+    HeapCellLease() {
+        for (HeapCell& c : g_heap_cells) {
+            bool free = false;
+            if (!c.used.load(std::memory_order_relaxed) && c.used.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                cell = &c;
+                break;
+            }
+        }
+    }
+    ~HeapCellLease() {
+        if (cell) cell->used.store(false, std::memory_order_release);
+        cell = nullptr; // allocations later in thread exit go to the overflow count
+    }
+};
+
+static uint64_t heap_allocs() {
+    uint64_t n = g_heap_overflow.load(std::memory_order_relaxed);
+    for (const HeapCell& c : g_heap_cells) n += c.n.load(std::memory_order_relaxed);
+    return n;
+}
+
+// Out of line, so the compiler never pairs a new-expression with a bare free() at a call site.
+#if defined(__GNUC__)
+#define HEAP_HOOK __attribute__((noinline))
+#else
+#define HEAP_HOOK
+#endif
+HEAP_HOOK void* operator new(std::size_t n) {
+    thread_local HeapCellLease lease;
+    if (HeapCell* c = lease.cell) c->n.store(c->n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    else g_heap_overflow.fetch_add(1, std::memory_order_relaxed);
+    for (;;) {
+        if (void* p = std::malloc(n ? n : 1)) return p;
+        const std::new_handler h = std::get_new_handler();
+        if (!h) throw std::bad_alloc();
+        h();
+    }
+}
+HEAP_HOOK void operator delete(void* p) noexcept { std::free(p); }
+HEAP_HOOK void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+// ------------------------------
+// metrics (GET /metrics, Prometheus text format)
+// ------------------------------
+enum MetricCounter {
+    kMetBytesIn, kMetBytesOut, kMetConnOpened, kMetConnClosed, kMetRecordsAppended,
+    kMetStatus2xx, kMetStatus3xx, kMetStatus4xx, kMetStatus5xx,
+    kMetCacheHits, kMetCacheMisses,
+    kMetRejectRateIp, kMetRejectRateAgent, kMetRejectOverload, kMetRejectTooLarge, kMetRejectTimeout, kMetRejectMalformed,
+    kMetRejectNotReady,
+    kMetTlsFull, kMetTlsResumed, kMetTlsFailed,
+    kMetCounterCount
+};
+
+enum MetricHist {
+    kMetAcceptWait, kMetParse, kMetValidate, kMetStorageAppend,
+    kMetRouteIndex, kMetRouteAssetsGet, kMetRouteAssetsDelta, kMetRouteExportCsv, kMetRouteAssetsPost, kMetRouteAssetsBatch,
+    kMetRouteStats, kMetRouteMetrics, kMetRouteOther,
+    kMetHistCount
+};
+
+// Histogram upper bounds in nanoseconds (1us .. 2.5s); one more bucket catches the rest.
+static const uint64_t kMetBucketsNs[] = {
+    1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+    10000000, 25000000, 50000000, 100000000, 250000000, 500000000, 1000000000, 2500000000ULL
+};
+static const size_t kMetBucketCount = sizeof(kMetBucketsNs) / sizeof(kMetBucketsNs[0]);
+
+// Counters of one thread. Only the owning thread writes (plain load + store, no locked
+// read-modify-write); the /metrics handler reads all shards concurrently.
+struct MetricsShard {
+    std::atomic<uint64_t> counters[kMetCounterCount];
+    std::atomic<uint64_t> buckets[kMetHistCount][kMetBucketCount + 1];
+    std::atomic<uint64_t> sum_ns[kMetHistCount];
+
+    MetricsShard() {
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        for (auto& h : buckets) for (auto& b : h) b.store(0, std::memory_order_relaxed);
+        for (auto& n : sum_ns) n.store(0, std::memory_order_relaxed);
+    }
+};
+
+struct MetricsTotals {
+    uint64_t counters[kMetCounterCount] = {};
+    uint64_t buckets[kMetHistCount][kMetBucketCount + 1] = {};
+    uint64_t sum_ns[kMetHistCount] = {};
+};
+
+class Metrics {
+public:
+    static void add(MetricCounter c, uint64_t n = 1) { bump(local().counters[c], n); }
+
+    static void observe(MetricHist h, std::chrono::steady_clock::duration d) {
+        const uint64_t ns = (uint64_t)std::max<long long>(0, (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        size_t b = 0;
+        while (b < kMetBucketCount && ns > kMetBucketsNs[b]) b++;
+        MetricsShard& s = local();
+        bump(s.buckets[h][b], 1);
+        bump(s.sum_ns[h], ns);
+    }
+
+    // Sums every shard, including those of threads that have exited (their shards are kept).
+    static void collect(MetricsTotals& t) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lk(r.mu);
+        for (const auto& s : r.shards) {
+            for (size_t i = 0; i < kMetCounterCount; i++) t.counters[i] += s->counters[i].load(std::memory_order_relaxed);
+            for (size_t h = 0; h < kMetHistCount; h++) {
+                for (size_t b = 0; b <= kMetBucketCount; b++) t.buckets[h][b] += s->buckets[h][b].load(std::memory_order_relaxed);
+                t.sum_ns[h] += s->sum_ns[h].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Registry {
+        std::mutex mu;
+        std::vector<std::unique_ptr<MetricsShard>> shards;
+    };
+
+    static Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    static MetricsShard& local() {
+        thread_local MetricsShard* shard = nullptr;
+        if (!shard) {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lk(r.mu);
+            r.shards.emplace_back(new MetricsShard());
+            shard = r.shards.back().get();
+        }
+        return *shard;
+    }
+
+    static void bump(std::atomic<uint64_t>& a, uint64_t n) {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// ------------------------------
+// group-commit storage writer
+// ------------------------------
+struct StorageOptions {
+    int batch_window_ms = 2;  // how long the first record of a batch waits for company
+    size_t batch_max = 1024;  // records per write() at most
+    bool fsync = true;        // fdatasync once per batch before acknowledging
+    uint64_t compact_bytes = 64ull << 20; // rotate + snapshot once the active log reaches this (0 = never)
+};
+
+// Single thread that owns the storage backend. Handlers queue records; the thread gathers
+// whatever arrived within the batch window, appends it with one write, syncs once,
+// applies it to the index and only then fires every record's completion.
+//
+// A record merged from a change message comes with the base it was merged onto. Replay merges
+// the logged change onto whatever precedes it in the log, so the writer only takes it while
+// that base is still the newest record for its key in log order (queued records included);
+// otherwise it is left out and reported stale, and the agent resends in full.
+class StorageWriter {
+public:
+    // `stale` lists the records (index within what was submitted) left out for a stale base.
+    using Done = std::function<void(bool ok, const std::vector<size_t>& stale)>;
+    using RecordPtr = std::shared_ptr<const AssetRecord>;
+
+    bool start(std::unique_ptr<StorageBackend> backend, const StorageOptions& opts, AssetStore* store) {
+        opts_ = opts;
+        store_ = store;
+        backend_ = std::move(backend);
+        thread_ = std::thread([this]{ run(); });
+        thread_.detach();
+        return true;
+    }
+
+    // Called on the writer thread after each batch has been applied to the store (set before start()).
+    void set_on_applied(std::function<void()> fn) { on_applied_ = std::move(fn); }
+
+    // Enables log compaction for backends that support rotation (set before start()).
+    void set_compactor(Compactor* c) { compactor_ = c; }
+
+    // `log`, when set, is the change message `rec` was merged from (see StorageBackend::append)
+    // and `base` the record it was merged onto.
+    void submit(RecordPtr rec, Done done, std::string log = std::string(), RecordPtr base = nullptr) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            queue_.push_back(Item{std::move(rec), {}, std::move(log), {}, std::move(base), {}, std::move(done), {}});
+            queued_++;
+        }
+        cv_.notify_one();
+    }
+
+    // Queues several records as one unit: they are never split across appends, so they land
+    // in a single write and share one completion. logs[i]/bases[i] as for submit().
+    void submit_batch(std::vector<RecordPtr> recs, Done done, std::vector<std::string> logs = {},
+                      std::vector<RecordPtr> bases = {}) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            queued_ += recs.size();
+            queue_.push_back(Item{nullptr, std::move(recs), {}, std::move(logs), nullptr, std::move(bases), std::move(done), {}});
+        }
+        cv_.notify_one();
+    }
+
+    size_t queue_depth() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return queued_;
+    }
+
+private:
+    struct Item {
+        RecordPtr rec;                // single POST
+        std::vector<RecordPtr> recs;  // batch POST (rec is null)
+        std::string log;              // per record: change message, or empty
+        std::vector<std::string> logs;
+        RecordPtr base;               // per record: what a change was merged onto, or null
+        std::vector<RecordPtr> bases;
+        Done done;
+        std::vector<size_t> stale;
+
+        size_t size() const { return rec ? 1 : recs.size(); }
+    };
+
+    // Moves the batch into recs_/lines_ in log order, leaving out changes whose base is no
+    // longer the newest record for their key.
+    void collect(std::vector<Item>& batch) {
+        recs_.clear();
+        lines_.clear();
+        latest_.clear();
+        const bool changes = store_ && std::any_of(batch.begin(), batch.end(), [](const Item& it) {
+            return it.base || std::any_of(it.bases.begin(), it.bases.end(), [](const RecordPtr& b) { return b != nullptr; });
+        });
+        auto take = [&](const RecordPtr& rec, const RecordPtr& base, std::string_view line) {
+            if (changes) {
+                std::string key = store_->key_of(rec->id, rec->hostname);
+                auto l = latest_.find(key);
+                if (base && base != (l != latest_.end() ? l->second : store_->find(key))) return false;
+                if (l != latest_.end()) l->second = rec;
+                else latest_.emplace(std::move(key), rec);
+            }
+            recs_.push_back(rec);
+            lines_.push_back(line);
+            return true;
+        };
+        for (auto& it : batch) {
+            if (it.rec) {
+                if (!take(it.rec, it.base, it.log)) it.stale.push_back(0);
+                continue;
+            }
+            for (size_t i = 0; i < it.recs.size(); i++) {
+                const RecordPtr& base = i < it.bases.size() ? it.bases[i] : nullptr;
+                if (!take(it.recs[i], base, i < it.logs.size() ? std::string_view(it.logs[i]) : std::string_view())) it.stale.push_back(i);
+            }
+        }
+    }
+
+    void run() {
+        std::vector<Item> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait(lk, [&]{ return !queue_.empty(); });
+                if (opts_.batch_window_ms > 0 && queued_ < opts_.batch_max) {
+                    cv_.wait_for(lk, std::chrono::milliseconds(opts_.batch_window_ms),
+                                 [&]{ return queued_ >= opts_.batch_max; });
+                }
+                // Whole items only; a batch POST larger than batch_max goes out on its own.
+                size_t n = 0, records = 0;
+                while (n < queue_.size() && (n == 0 || records + queue_[n].size() <= opts_.batch_max)) {
+                    records += queue_[n].size();
+                    n++;
+                }
+                batch.assign(std::make_move_iterator(queue_.begin()), std::make_move_iterator(queue_.begin() + (std::ptrdiff_t)n));
+                queue_.erase(queue_.begin(), queue_.begin() + (std::ptrdiff_t)n);
+                queued_ -= records;
+            }
+
+            collect(batch);
+            const auto t0 = std::chrono::steady_clock::now();
+            const bool ok = backend_->append(recs_, lines_, opts_.fsync);
+            Metrics::observe(kMetStorageAppend, std::chrono::steady_clock::now() - t0);
+            if (ok) Metrics::add(kMetRecordsAppended, recs_.size());
+            if (!ok) log_err("DB write failed: " + err_text(errno));
+            if (ok && store_) {
+                store_->apply(recs_); // one root swap per batch
+                if (on_applied_) on_applied_();
+            }
+            // Rotate only once the batch is in the index, so the snapshot covers the whole segment.
+            if (ok && compactor_ && opts_.compact_bytes && backend_->active_bytes() >= opts_.compact_bytes && !compactor_->busy()) {
+                if (const uint64_t seg = backend_->rotate()) compactor_->request(seg);
+            }
+            for (auto& it : batch) {
+                if (it.done) it.done(ok, it.stale);
+            }
+            batch.clear();
+        }
+    }
+
+    StorageOptions opts_;
+    AssetStore* store_ = nullptr;
+    std::function<void()> on_applied_;
+    Compactor* compactor_ = nullptr;
+    std::unique_ptr<StorageBackend> backend_;
+    std::vector<RecordPtr> recs_;
+    std::vector<std::string_view> lines_;
+    std::unordered_map<std::string, RecordPtr> latest_; // collect(): newest record per key so far
+    std::thread thread_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Item> queue_;
+    size_t queued_ = 0; // records in queue_
+};
+
+// ------------------------------
+// change feed (long-poll delta reads)
+// ------------------------------
+// Parks long-poll requests until the store sequence passes the one they already have, or
+// their deadline expires. Wake-ups run on the feed's own thread, never on the storage writer.
+class ChangeFeed {
+public:
+    using Wake = std::function<void()>;
+
+    void start(uint64_t seq) {
+        seq_ = seq;
+        std::thread([this]{ run(); }).detach();
+    }
+
+    void park(uint64_t since, std::chrono::steady_clock::time_point deadline, Wake wake) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            waiters_.push_back(Waiter{since, deadline, std::move(wake)});
+        }
+        cv_.notify_one();
+    }
+
+    void notify(uint64_t seq) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            seq_ = seq;
+        }
+        cv_.notify_one();
+    }
+
+private:
+    struct Waiter {
+        uint64_t since;
+        std::chrono::steady_clock::time_point deadline;
+        Wake wake;
+    };
+
+    void run() {
+        std::vector<Wake> due;
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            const auto now = std::chrono::steady_clock::now();
+            auto next = now + std::chrono::hours(1);
+            for (size_t i = 0; i < waiters_.size(); ) {
+                if (seq_ > waiters_[i].since || waiters_[i].deadline <= now) {
+                    due.push_back(std::move(waiters_[i].wake));
+                    waiters_[i] = std::move(waiters_.back());
+                    waiters_.pop_back();
+                } else {
+                    next = std::min(next, waiters_[i].deadline);
+                    i++;
+                }
+            }
+            if (!due.empty()) {
+                lk.unlock();
+                for (auto& w : due) w();
+                due.clear();
+                lk.lock();
+                continue;
+            }
+            cv_.wait_until(lk, next);
+        }
+    }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    uint64_t seq_ = 0;
+    std::vector<Waiter> waiters_;
+};
+
+// ------------------------------
+// response cache (read endpoints)
+// ------------------------------
+// Complete responses, headers included, ready to send as they are. Each entry is only good
+// for the store version it was built from, and the write path drops all of them, so a hit
+// is never stale. Pollers asking for the same thing share one buffer.
+class ResponseCache {
+public:
+    void set_budget(size_t bytes) { budget_ = bytes; }
+    size_t max_entry() const { return budget_ / 4; }
+
+    std::shared_ptr<const std::string> get(std::string_view key, uint64_t seq) {
+        if (!budget_) return nullptr;
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = map_.find(key);
+        if (it == map_.end() || it->second.seq != seq) {
+            Metrics::add(kMetCacheMisses);
+            return nullptr;
+        }
+        Metrics::add(kMetCacheHits);
+        return it->second.wire;
+    }
+
+    // Keeps `wire` unless it is too big; older entries are evicted to make room.
+    void put(std::string_view key, uint64_t seq, const std::shared_ptr<const std::string>& wire) {
+        if (wire->size() > max_entry()) return;
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = map_.find(key);
+        if (it != map_.end()) { bytes_ -= it->second.wire->size(); map_.erase(it); }
+        while (bytes_ + wire->size() > budget_ && !map_.empty()) {
+            bytes_ -= map_.begin()->second.wire->size();
+            map_.erase(map_.begin());
+        }
+        auto owned = std::make_unique<std::string>(key);
+        const std::string_view k = *owned;
+        map_.emplace(k, Entry{seq, wire, std::move(owned)});
+        bytes_ += wire->size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lk(mu_);
+        map_.clear();
+        bytes_ = 0;
+    }
+
+private:
+    struct Entry {
+        uint64_t seq;
+        std::shared_ptr<const std::string> wire;
+        std::unique_ptr<std::string> key; // the map key views this, so lookups need no std::string
+    };
+    size_t budget_ = 0; // bytes; 0 disables the cache
+    std::mutex mu_;
+    std::unordered_map<std::string_view, Entry> map_;
+    size_t bytes_ = 0;
+};
+
+// ------------------------------
+// admission control (request limits, rate limits, overload)
+// ------------------------------
+struct AdmissionOptions {
+    size_t max_header_bytes = 64 << 10;
+    size_t max_body_bytes = 16 << 20;
+    int header_timeout_ms = 10000; // from the first byte of a request to the end of its headers
+    int body_timeout_ms = 60000;   // from the first byte to the end of its body
+    size_t max_inflight = 4096;    // ingest requests waiting for storage, across all connections
+    size_t max_queue = 65536;      // storage queue depth (records) from which ingest is refused
+};
+
+// Token buckets per client key (source IP or agent id): `rate` tokens per second, up to
+// `burst`. Buckets that have refilled completely are dropped when the table grows, so
+// a flood of one-off clients costs memory only while they are actually limited.
+class RateLimiter {
+public:
+    void configure(double rate, double burst) {
+        rate_ = rate;
+        burst_ = std::max(1.0, burst);
+    }
+
+    bool enabled() const { return rate_ > 0; }
+
+    // Takes a token for `key`. Without one, returns false and the whole seconds until the next.
+    // Buckets are found by a 64-bit hash of the key, so checking one never copies the key.
+    bool allow(std::string_view key, int* retry_after_s) {
+        using clock = std::chrono::steady_clock;
+        const clock::time_point now = clock::now();
+        const uint64_t h = fnv1a64(kFnvOffset, key);
+        Shard& sh = shards_[h % kShards];
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.map.find(h);
+        if (it == sh.map.end()) {
+            if (sh.map.size() >= sh.sweep_at) sweep(sh, now);
+            it = sh.map.emplace(h, Bucket{burst_, now}).first;
+        }
+        Bucket& b = it->second;
+        b.tokens = std::min(burst_, b.tokens + std::chrono::duration<double>(now - b.at).count() * rate_);
+        b.at = now;
+        if (b.tokens >= 1.0) { b.tokens -= 1.0; return true; }
+        *retry_after_s = std::max(1, (int)std::ceil((1.0 - b.tokens) / rate_));
+        return false;
+    }
+
+private:
+    struct Bucket {
+        double tokens;
+        std::chrono::steady_clock::time_point at;
+    };
+    struct Shard {
+        std::mutex mu;
+        std::unordered_map<uint64_t, Bucket> map;
+        size_t sweep_at = 1024;
+    };
+    static const size_t kShards = 16;
+
+    void sweep(Shard& sh, std::chrono::steady_clock::time_point now) {
+        for (auto it = sh.map.begin(); it != sh.map.end();) {
+            const double t = it->second.tokens + std::chrono::duration<double>(now - it->second.at).count() * rate_;
+            if (t >= burst_) it = sh.map.erase(it);
+            else ++it;
+        }
+        sh.sweep_at = std::max<size_t>(1024, sh.map.size() * 2);
+    }
+
+    double rate_ = 0, burst_ = 1;
+    Shard shards_[kShards];
+};
+
+// "<req/s>[:<burst>]"; the burst defaults to twice the rate. "0" turns the limit off.
+static bool parse_rate_limit(const std::string& s, double* rate, double* burst) {
+    const size_t colon = s.find(':');
+    char* end = nullptr;
+    *rate = std::strtod(s.c_str(), &end);
+    if (end == s.c_str() || (colon == std::string::npos ? *end != '\0' : end != s.c_str() + colon) || !(*rate >= 0)) return false;
+    if (colon == std::string::npos) { *burst = std::max(1.0, 2 * *rate); return true; }
+    *burst = std::strtod(s.c_str() + colon + 1, &end);
+    return end != s.c_str() + colon + 1 && *end == '\0' && *burst >= 1;
+}
+
+// Error response for a refused request; Retry-After goes out when the client should come back.
+static std::string refusal(int code, const std::string& error, bool keep_alive, int retry_after_s = 0) {
+    return http_response(code, "application/json; charset=utf-8", "{\"error\":\"" + json_escape(error) + "\"}", keep_alive,
+                         retry_after_s > 0 ? "Retry-After: " + std::to_string(retry_after_s) + "\r\n" : std::string());
+}
+
+// ------------------------------
+// HTTP server: request parsing + routing
+// ------------------------------
+// Scratch memory for one request: the short text a handler needs while it runs (ETags, cache
+// keys, extra header lines). Blocks stay with the connection and reset() rewinds them after each
+// request, so a warmed-up connection serves requests without allocating for these.
+class RequestArena {
+public:
+    static const size_t kBlockBytes = 4096;
+
+    char* alloc(size_t n) {
+        while (cur_ < blocks_.size() && used_ + n > blocks_[cur_].size) { cur_++; used_ = 0; }
+        if (cur_ == blocks_.size()) {
+            const size_t size = std::max(n, kBlockBytes);
+            blocks_.push_back(Block{std::unique_ptr<char[]>(new char[size]), size});
+            used_ = 0;
+        }
+        char* p = blocks_[cur_].data.get() + used_;
+        used_ += n;
+        return p;
+    }
+
+    // The pieces, concatenated into arena memory.
+    std::string_view cat(std::initializer_list<std::string_view> parts) {
+        size_t n = 0;
+        for (auto p : parts) n += p.size();
+        char* out = alloc(n);
+        char* w = out;
+        for (auto p : parts) { if (!p.empty()) std::memcpy(w, p.data(), p.size()); w += p.size(); }
+        return std::string_view(out, n);
+    }
+
+    void reset() { cur_ = 0; used_ = 0; }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t cur_ = 0, used_ = 0;
+};
+
+// The views point into the connection's receive buffer (peer: into the connection) and are
+// valid only while the request is being handled; whatever outlives that is copied.
+struct HttpRequest {
+    std::string_view method, path, ver;
+    std::string_view headers;
+    std::string_view body;
+    bool keep_alive = false;
+    ContentEncoding accept = kEncIdentity; // preferred coding from Accept-Encoding
+    std::string_view peer;                 // client IP, for the per-IP rate limit
+    RequestArena* arena = nullptr;         // the connection's, rewound after each request
+};
+
+struct ServerContext {
+    std::string db_path;
+    std::string html;
+    std::string html_gzip, html_deflate; // compressed once at startup
+    CompressionOptions compression;
+    int threads = 1;
+    int idle_timeout_ms = 30000; // keep-alive connections idle longer than this are closed
+    int backlog = SOMAXCONN;     // listen() queue of not yet accepted connections
+    AdmissionOptions admission;
+    RateLimiter rate_ip, rate_agent;
+    std::atomic<size_t> ingest_inflight{0};
+    double access_log_sample = 0; // share of requests written to the access log
+    StorageOptions storage;
+    AssetStore store;
+    StorageWriter writer;
+    ChangeFeed feed;
+    Compactor compactor;
+    ResponseCache cache;
+    LoadProgress load; // requests other than the probes get 503 until load.ready
+    std::unique_ptr<TlsContext> tls; // set: every connection is HTTPS
+};
+
+// Lets a handler answer after returning (e.g. once its storage batch is durable).
+// May be invoked from any thread, exactly once.
+using DeferredReply = std::function<void(HttpResponse response)>;
+
+// Hands a handler the DeferredReply for its request. The callback is only built when a handler
+// asks for it, so the many requests answered on the spot never allocate one.
+struct ReplyLater {
+    virtual ~ReplyLater() = default;
+    virtual DeferredReply make() const = 0;
+};
+
+// Parses the complete request at the front of `data` without copying it. Returns 1 when `req`
+// was filled and *used holds the request's length (the caller consumes those bytes once it is
+// done with `req`), 0 when more bytes are needed, or minus the status to refuse it with: -400
+// malformed, -431 headers over the limit, -413 a Content-Length over the limit (known before
+// the body is read), -501 a Transfer-Encoding.
+//
+// Only Content-Length delimits a body. A chunked (or otherwise encoded) body, or a repeated
+// Content-Length, would leave this parser and an intermediary disagreeing on where the next
+// pipelined request starts, so such requests are refused and the connection is closed.
+static int parse_request(std::string_view data, HttpRequest& req, const AdmissionOptions& lim, size_t* used) {
+    const size_t hdr_end = data.find("\r\n\r\n");
+    if (hdr_end == std::string_view::npos) return data.size() >= lim.max_header_bytes ? -431 : 0;
+    if (hdr_end > lim.max_header_bytes) return -431;
+
+    // Request line: method, target and version separated by blanks.
+    const std::string_view line = data.substr(0, data.find("\r\n"));
+    std::string_view parts[3];
+    for (size_t n = 0, pos = 0; n < 3; n++) {
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t')) pos++;
+        const size_t start = pos;
+        while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t') pos++;
+        parts[n] = line.substr(start, pos - start);
+    }
+    req.method = parts[0];
+    req.path = parts[1];
+    req.ver = parts[2];
+    if (req.method.empty() || req.path.empty()) return -400;
+    req.headers = data.substr(0, hdr_end);
+
+    unsigned long long content_len = 0;
+    std::string_view v;
+    size_t at = 0;
+    const bool has_len = header_next(req.headers, "Content-Length", &at, v);
+    if (has_len && (!parse_uint(v, ULLONG_MAX, &content_len) || header_next(req.headers, "Content-Length", &at, v))) return -400;
+    if (header_value(req.headers, "Transfer-Encoding", v)) return has_len ? -400 : -501;
+    if (content_len > lim.max_body_bytes) return -413;
+
+    // HTTP/1.1 keeps the connection open unless told otherwise; HTTP/1.0 only when asked.
+    const bool has_conn = header_value(req.headers, "Connection", v);
+    if (req.ver == "HTTP/1.1") req.keep_alive = !(has_conn && iequals(v, "close"));
+    else req.keep_alive = has_conn && iequals(v, "keep-alive");
+    req.accept = header_value(req.headers, "Accept-Encoding", v) ? pick_encoding(v) : kEncIdentity;
+
+    const size_t total = hdr_end + 4 + (size_t)content_len;
+    if (data.size() < total) return 0;
+    req.body = data.substr(hdr_end + 4, (size_t)content_len);
+    *used = total;
+    return 1;
+}
+
+// The answer to a request parse_request() refused; the connection is closed after it.
+static std::string parse_refusal(int rc) {
+    Metrics::add(rc == -413 || rc == -431 ? kMetRejectTooLarge : kMetRejectMalformed);
+    return refusal(-rc, rc == -413 ? "request body too large" : rc == -431 ? "request headers too large"
+                      : rc == -501 ? "Transfer-Encoding is not supported; send a Content-Length" : "malformed request", false);
+}
+
+// Whether the partial request in `in`, begun at `start`, ran out of time: its headers must
+// arrive within the header timeout, the whole request within the body timeout.
+static bool request_overdue(const AdmissionOptions& lim, std::string_view in, std::chrono::steady_clock::time_point start,
+                            std::chrono::steady_clock::time_point now) {
+    const bool headers_done = in.find("\r\n\r\n") != std::string_view::npos;
+    return now - start > std::chrono::milliseconds(headers_done ? lim.body_timeout_ms : lim.header_timeout_ms);
+}
+
+static std::string timeout_refusal() {
+    Metrics::add(kMetRejectTimeout);
+    return refusal(408, "request not received in time", false);
+}
+
+// Ingest is refused while storage is behind: too many requests already waiting for their
+// append, or the writer queue past its limit.
+static bool ingest_overloaded(ServerContext& ctx) {
+    return ctx.ingest_inflight.load(std::memory_order_relaxed) >= ctx.admission.max_inflight ||
+           ctx.writer.queue_depth() >= ctx.admission.max_queue;
+}
+
+// The coding to answer `req` with; identity when compression is turned off.
+static ContentEncoding response_encoding(const ServerContext& ctx, const HttpRequest& req) {
+    return ctx.compression.level > 0 ? req.accept : kEncIdentity;
+}
+
+// Like http_response, but compresses bodies of at least min_bytes. Vary goes out either way
+// so shared caches keep the codings apart.
+static std::string http_response_encoded(int code, const std::string& content_type, const std::string& body, bool keep_alive,
+                                         ContentEncoding enc, const CompressionOptions& opt, std::string extra = std::string()) {
+    extra += "Vary: Accept-Encoding\r\n";
+    if (enc == kEncIdentity || body.size() < opt.min_bytes) return http_response(code, content_type, body, keep_alive, extra);
+    extra += "Content-Encoding: "; extra += encoding_name(enc); extra += "\r\n";
+    return http_response(code, content_type, compress_body(body, enc, opt.level), keep_alive, extra);
+}
+
+// HTTP/1.1 clients get chunked encoding and keep their connection; HTTP/1.0 clients get the
+// body delimited by connection close. The body is compressed as it is produced, so there is
+// no size threshold here.
+static HttpResponse stream_response(const HttpRequest& req, const std::string& content_type, std::unique_ptr<BodyStream> body,
+                                    std::string extra = std::string(), ContentEncoding enc = kEncIdentity, int level = 0) {
+    if (enc != kEncIdentity) {
+        extra += "Vary: Accept-Encoding\r\nContent-Encoding: "; extra += encoding_name(enc); extra += "\r\n";
+        body.reset(new CompressedStream(std::move(body), enc, level));
+    }
+    HttpResponse r;
+    r.chunked = req.ver == "HTTP/1.1";
+    r.close = !r.chunked;
+    r.wire = http_head(200, content_type, -1, req.keep_alive && r.chunked, r.chunked, extra);
+    r.stream = std::move(body);
+    return r;
+}
+
+// ------------------------------
+// streamed read endpoints
+// ------------------------------
+// Pages through one snapshot of the store a few records at a time, so a slow client sees a
+// consistent listing while ingest goes on; memory per request stays constant.
+class StoreStream : public BodyStream {
+public:
+    explicit StoreStream(const AssetStore& store) : snap_(store.snapshot()) {}
+
+    bool next(std::string& out, size_t budget) override {
+        if (!started_) { begin(out); started_ = true; }
+        while (out.size() < budget) {
+            batch_.clear();
+            if (AssetStore::read_range(*snap_, cursor_, 64, batch_) == 0) { end(out); return false; }
+            for (const auto& r : batch_) { row(out, *r, cursor_ == 0); cursor_++; }
+        }
+        return true;
+    }
+
+protected:
+    virtual void begin(std::string& out) = 0;
+    virtual void row(std::string& out, const AssetRecord& r, bool first) = 0;
+    virtual void end(std::string& out) = 0;
+
+private:
+    std::shared_ptr<const AssetStore::Snapshot> snap_;
+    size_t cursor_ = 0;
+    bool started_ = false;
+    std::vector<std::shared_ptr<const AssetRecord>> batch_;
+};
+
+class AssetJsonStream : public StoreStream {
+public:
+    using StoreStream::StoreStream;
+protected:
+    void begin(std::string& out) override { out += '['; }
+    void row(std::string& out, const AssetRecord& r, bool first) override {
+        if (!first) out += ',';
+        out += r.json;
+    }
+    void end(std::string& out) override { out += ']'; }
+};
+
+class AssetCsvStream : public StoreStream {
+public:
+    using StoreStream::StoreStream;
+protected:
+    void begin(std::string& out) override { out += "id,hostname,os,cpu_cores,ram_mb,ip,timestamp\n"; }
+    void row(std::string& out, const AssetRecord& r, bool) override {
+        out += r.id; out += ',';
+        out += r.hostname; out += ',';
+        out += r.os; out += ',';
+        out += r.cpu_cores; out += ',';
+        out += r.ram_mb; out += ',';
+        out += r.ip; out += ',';
+        out += r.timestamp; out += '\n';
+    }
+    void end(std::string&) override {}
+};
+
+// ------------------------------
+// query API (GET /api/assets?..., GET /api/export.csv?...)
+// ------------------------------
+static const char* const kAssetFields[] = {"id", "hostname", "os", "cpu_cores", "ram_mb", "ip", "timestamp"};
+static const size_t kAssetFieldCount = sizeof(kAssetFields) / sizeof(kAssetFields[0]);
+static const size_t kQueryDefaultLimit = 1000; // JSON pages; CSV exports are unlimited unless asked
+static const size_t kQueryMaxLimit = 10000;
 
-        if (method == "GET" && (path == "/" || path == "/index.html")) {
-            std::string resp = http_response(200, "text/html; charset=utf-8", html);
-            send_all(cfd, resp);
+static std::string_view asset_field(const AssetRecord& r, size_t f) {
+    switch (f) {
+    case 0: return r.id;
+    case 1: return r.hostname;
+    case 2: return r.os;
+    case 3: return r.cpu_cores;
+    case 4: return r.ram_mb;
+    case 5: return r.ip;
+    default: return r.timestamp;
+    }
+}
+
+static std::string url_decode(std::string_view s) {
+    auto hex = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '+') out += ' ';
+        else if (s[i] == '%' && i + 2 < s.size() && hex(s[i + 1]) >= 0 && hex(s[i + 2]) >= 0) {
+            out += (char)(hex(s[i + 1]) * 16 + hex(s[i + 2]));
+            i += 2;
+        } else out += s[i];
+    }
+    return out;
+}
+
+// Finds `key` in a raw query string and stores its decoded value.
+static bool query_param(std::string_view qs, const char* key, std::string& out) {
+    while (!qs.empty()) {
+        const size_t amp = qs.find('&');
+        const std::string_view pair = qs.substr(0, amp);
+        qs = amp == std::string_view::npos ? std::string_view() : qs.substr(amp + 1);
+        const size_t eq = pair.find('=');
+        if (url_decode(pair.substr(0, eq)) != key) continue;
+        out = eq == std::string_view::npos ? std::string() : url_decode(pair.substr(eq + 1));
+        return true;
+    }
+    return false;
+}
+
+// Cursors are opaque to clients: a slot number for slot-order pages, otherwise the index
+// ('h', 't' or 'r'), the slot and the value of the entry to resume at, hostnames hex-encoded
+// so the token needs no escaping in a URL.
+static std::string cursor_token(const AssetCursor& c) {
+    if (c.order == 's') return std::to_string(c.slot);
+    std::string out(1, c.order);
+    out += std::to_string(c.slot);
+    out += '.';
+    if (c.order != 'h') return out + std::to_string(c.num);
+    static const char hex[] = "0123456789abcdef";
+    for (unsigned char ch : c.host) { out += hex[ch >> 4]; out += hex[ch & 15]; }
+    return out;
+}
+
+static bool parse_cursor(std::string_view v, AssetCursor& c) {
+    unsigned long long n;
+    c = AssetCursor();
+    if (parse_uint(v, SIZE_MAX - 1, &n)) { c.order = 's'; c.slot = (size_t)n; return true; }
+    const size_t dot = v.find('.');
+    if (v.empty() || (v[0] != 'h' && v[0] != 't' && v[0] != 'r') || dot == std::string_view::npos) return false;
+    if (!parse_uint(v.substr(1, dot - 1), SIZE_MAX - 1, &n)) return false;
+    c.order = v[0];
+    c.slot = (size_t)n;
+    std::string_view val = v.substr(dot + 1);
+    if (c.order == 'h') {
+        auto nibble = [](char ch) { return ch >= '0' && ch <= '9' ? ch - '0' : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 : -1; };
+        if (val.size() % 2) return false;
+        for (size_t i = 0; i < val.size(); i += 2) {
+            const int hi = nibble(val[i]), lo = nibble(val[i + 1]);
+            if (hi < 0 || lo < 0) return false;
+            c.host += (char)(hi * 16 + lo);
+        }
+        return true;
+    }
+    const bool neg = !val.empty() && val[0] == '-';
+    if (!parse_uint(val.substr(neg), neg ? (unsigned long long)LLONG_MAX + 1 : LLONG_MAX, &n)) return false;
+    c.num = neg ? (long long)(0 - n) : (long long)n;
+    return true;
+}
+
+// Reads the filter, paging and projection parameters; *used tells whether there were any.
+// Unknown parameters are ignored, so a cache-busting suffix alone still gets the full listing;
+// malformed values are reported through *why.
+static bool build_asset_query(std::string_view qs, bool csv, AssetQuery& q, std::vector<size_t>& fields, bool* used, std::string* why) {
+    *used = false;
+    if (!csv) q.limit = kQueryDefaultLimit;
+    while (!qs.empty()) {
+        const size_t amp = qs.find('&');
+        const std::string_view pair = qs.substr(0, amp);
+        qs = amp == std::string_view::npos ? std::string_view() : qs.substr(amp + 1);
+        if (pair.empty()) continue;
+        const size_t eq = pair.find('=');
+        const std::string key = url_decode(pair.substr(0, eq));
+        const std::string val = eq == std::string_view::npos ? std::string() : url_decode(pair.substr(eq + 1));
+        unsigned long long n;
+
+        if (key == "os" || key == "hostname_prefix" || key == "min_ram_mb" || key == "since" || key == "limit" ||
+            key == "cursor" || key == "fields") *used = true;
+        if (key == "os") {
+            q.has_os = true;
+            q.os = val;
+        } else if (key == "hostname_prefix") {
+            q.has_prefix = true;
+            q.hostname_prefix = val;
+        } else if (key == "min_ram_mb") {
+            if (!parse_uint(val, LLONG_MAX, &n)) { *why = "min_ram_mb must be a non-negative integer"; return false; }
+            q.min_ram_mb = (long long)n;
+        } else if (key == "since") {
+            // ISO-8601 like the stored timestamps, or epoch seconds.
+            if (parse_uint(val, LLONG_MAX, &n)) q.since = (long long)n;
+            else if ((q.since = timestamp_utc(val)) == LLONG_MIN) { *why = "since must be an ISO-8601 timestamp or epoch seconds"; return false; }
+        } else if (key == "limit") {
+            if (!parse_uint(val, kQueryMaxLimit, &n) || n == 0) { *why = "limit must be between 1 and " + std::to_string(kQueryMaxLimit); return false; }
+            q.limit = (size_t)n;
+        } else if (key == "cursor") {
+            if (!parse_cursor(val, q.cursor)) { *why = "invalid cursor"; return false; }
+        } else if (key == "fields") {
+            fields.clear();
+            size_t at = 0;
+            while (at <= val.size()) {
+                const size_t comma = std::min(val.find(',', at), val.size());
+                const std::string name = val.substr(at, comma - at);
+                at = comma + 1;
+                if (name.empty()) continue;
+                size_t f = 0;
+                while (f < kAssetFieldCount && name != kAssetFields[f]) f++;
+                if (f == kAssetFieldCount) { *why = "unknown field: " + name; return false; }
+                fields.push_back(f);
+            }
+        }
+    }
+    // Only the hostname index holds every asset; the others leave out values that did not parse,
+    // so resuming in them is only right while the filter that excludes those is still given.
+    if ((q.cursor.order == 't' && q.since == LLONG_MIN) || (q.cursor.order == 'r' && q.min_ram_mb < 0)) {
+        *why = "cursor does not belong to this query";
+        return false;
+    }
+    return true;
+}
+
+// Field values are kept as the escaped text from the original JSON, so they are copied as is.
+static void append_projection(std::string& out, const AssetRecord& r, const std::vector<size_t>& fields) {
+    out += '{';
+    for (size_t i = 0; i < fields.size(); i++) {
+        const size_t f = fields[i];
+        if (i) out += ',';
+        out += '"'; out += kAssetFields[f]; out += "\":";
+        const bool number = (f == 3 && r.cpu_cores_num >= 0) || (f == 4 && r.ram_mb_num >= 0);
+        if (number) out += asset_field(r, f);
+        else { out += '"'; out += asset_field(r, f); out += '"'; }
+    }
+    out += '}';
+}
+
+// A filtered CSV export has no limit unless one is asked for, so it is streamed: each piece
+// runs the query for the next few matches from where the last one stopped. Pages read the
+// index as it is at that moment, like a client paging with next_cursor.
+class QueryCsvStream : public BodyStream {
+public:
+    QueryCsvStream(const AssetStore& store, const AssetQuery& q, std::vector<size_t> fields)
+        : store_(store), q_(q), fields_(std::move(fields)), left_(q.limit) {}
+
+    bool next(std::string& out, size_t budget) override {
+        if (!started_) {
+            for (size_t i = 0; i < fields_.size(); i++) { if (i) out += ','; out += kAssetFields[fields_[i]]; }
+            out += '\n';
+            started_ = true;
+        }
+        while (out.size() < budget) {
+            if (!left_) return false;
+            batch_.clear();
+            AssetCursor next;
+            q_.limit = std::min<size_t>(left_, 256);
+            left_ -= store_.query(q_, batch_, &next);
+            for (const auto& r : batch_) {
+                for (size_t i = 0; i < fields_.size(); i++) { if (i) out += ','; out += asset_field(*r, fields_[i]); }
+                out += '\n';
+            }
+            if (!next.order) return false;
+            q_.cursor = std::move(next);
+        }
+        return true;
+    }
+
+private:
+    const AssetStore& store_;
+    AssetQuery q_;
+    std::vector<size_t> fields_;
+    size_t left_;
+    bool started_ = false;
+    std::vector<std::shared_ptr<const AssetRecord>> batch_;
+};
+
+// JSON reads are bounded by `limit`, so they are built in one piece rather than streamed.
+static HttpResponse query_response(const ServerContext& ctx, const HttpRequest& req, const AssetQuery& q, std::vector<size_t> fields,
+                                   bool csv, const std::string& extra) {
+    if (csv) {
+        if (fields.empty()) for (size_t f = 0; f < kAssetFieldCount; f++) fields.push_back(f);
+        return stream_response(req, "text/csv; charset=utf-8", std::unique_ptr<BodyStream>(new QueryCsvStream(ctx.store, q, std::move(fields))),
+                               extra, response_encoding(ctx, req), ctx.compression.level);
+    }
+
+    std::vector<std::shared_ptr<const AssetRecord>> hits;
+    AssetCursor next;
+    ctx.store.query(q, hits, &next);
+
+    std::string body = "{\"items\":[";
+    for (size_t i = 0; i < hits.size(); i++) {
+        if (i) body += ',';
+        if (fields.empty()) body += hits[i]->json;
+        else append_projection(body, *hits[i], fields);
+    }
+    body += "],\"next_cursor\":";
+    body += next.order ? "\"" + cursor_token(next) + "\"" : "null";
+    body += '}';
+    return http_response_encoded(200, "application/json; charset=utf-8", body, req.keep_alive, response_encoding(ctx, req), ctx.compression, extra);
+}
+
+// ------------------------------
+// fleet statistics (GET /api/stats[?group_by=os])
+// ------------------------------
+// The store keeps these aggregates up to date on every upsert, so a response costs the same for
+// ten assets or ten million: it walks the distinct values, histogram buckets and report hours,
+// never the assets.
+static void append_num_stats(std::string& out, const NumStats& n) {
+    out += "{\"count\":" + std::to_string(n.count) + ",\"sum\":" + std::to_string(n.sum);
+    if (n.count) {
+        char mean[32];
+        std::snprintf(mean, sizeof(mean), "%.2f", (double)n.sum / (double)n.count);
+        out += ",\"min\":" + std::to_string(n.values.begin()->first) + ",\"max\":" + std::to_string(n.values.rbegin()->first);
+        out += ",\"mean\":";
+        out += mean;
+    } else {
+        out += ",\"min\":null,\"max\":null,\"mean\":null";
+    }
+    out += ",\"histogram\":[";
+    bool first = true;
+    for (size_t b = 0; b < NumStats::kBuckets; b++) {
+        if (!n.hist[b]) continue;
+        if (!first) out += ',';
+        first = false;
+        out += "{\"le\":" + std::to_string(1ULL << b) + ",\"count\":" + std::to_string(n.hist[b]) + "}";
+    }
+    out += "]}";
+}
+
+// last_seen buckets are relative to `now`, so a report from the current hour is "under_1h" even
+// if it is 59 minutes old; hour granularity is what keeps the counts incremental (SeenBuckets).
+static void append_fleet_stats(std::string& out, const FleetStats& st, long long now) {
+    size_t seen[4];
+    st.seen.read(utc_hour(now), seen);
+    const size_t under_1h = seen[SeenBuckets::kUnder1h], under_24h = seen[SeenBuckets::kUnder24h],
+                 under_7d = seen[SeenBuckets::kUnder7d], older = seen[SeenBuckets::kOlder];
+    out += "{\"assets\":" + std::to_string(st.assets) + ",\"cpu_cores\":";
+    append_num_stats(out, st.cpu_cores);
+    out += ",\"ram_mb\":";
+    append_num_stats(out, st.ram_mb);
+    out.pop_back();
+    out += ",\"na\":" + std::to_string(st.ram_na) + "}";
+    out += ",\"last_seen\":{\"under_1h\":" + std::to_string(under_1h) + ",\"1h_24h\":" + std::to_string(under_24h) +
+           ",\"24h_7d\":" + std::to_string(under_7d) + ",\"over_7d\":" + std::to_string(older) +
+           ",\"unknown\":" + std::to_string(st.seen_unknown) +
+           ",\"not_seen_24h\":" + std::to_string(under_7d + older) + "}}";
+}
+
+// Not cached: last_seen moves with the clock even when no asset changes.
+static HttpResponse stats_response(const ServerContext& ctx, const HttpRequest& req, std::string_view qs) {
+    std::string group_by;
+    query_param(qs, "group_by", group_by);
+    if (!group_by.empty() && group_by != "os") {
+        return http_response(400, "application/json; charset=utf-8",
+                             "{\"error\":\"unsupported group_by (supported: os)\"}", req.keep_alive);
+    }
+    const long long now = (long long)std::time(nullptr);
+    std::string body;
+    ctx.store.read_stats([&](const FleetStats& all, const std::vector<std::pair<std::string_view, const FleetStats*>>& groups) {
+        body += "{\"seq\":" + std::to_string(ctx.store.seq()) + ",\"total\":";
+        append_fleet_stats(body, all, now);
+        body += ",\"os\":{";
+        for (size_t i = 0; i < groups.size(); i++) {
+            if (i) body += ',';
+            body += '"' + json_escape(std::string(groups[i].first)) + "\":" + std::to_string(groups[i].second->assets);
+        }
+        body += '}';
+        if (!group_by.empty()) {
+            body += ",\"groups\":{";
+            for (size_t i = 0; i < groups.size(); i++) {
+                if (i) body += ',';
+                body += '"' + json_escape(std::string(groups[i].first)) + "\":";
+                append_fleet_stats(body, *groups[i].second, now);
+            }
+            body += '}';
+        }
+        body += '}';
+    });
+    return http_response_encoded(200, "application/json; charset=utf-8", body, req.keep_alive, response_encoding(ctx, req),
+                                 ctx.compression, "Cache-Control: no-store\r\n");
+}
+
+// ------------------------------
+// conditional and delta reads (ETag, ?since_seq=N)
+// ------------------------------
+static const unsigned kMaxPollWaitSec = 60;
+
+// Each coding is its own representation, so it gets its own tag ("<seq>-gzip"). Formatted in
+// place; view() is valid as long as the object.
+struct Etag {
+    char text[48];
+    size_t len;
+
+    Etag(uint64_t seq, ContentEncoding enc) {
+        text[0] = '"';
+        char* p = std::to_chars(text + 1, text + sizeof(text) - 16, seq).ptr;
+        if (enc != kEncIdentity) {
+            *p++ = '-';
+            for (const char* n = encoding_name(enc); *n; n++) *p++ = *n;
+        }
+        *p++ = '"';
+        len = (size_t)(p - text);
+    }
+    std::string_view view() const { return std::string_view(text, len); }
+};
+
+// True when the client's If-None-Match already names the current version.
+static bool etag_matches(const HttpRequest& req, std::string_view etag) {
+    std::string_view v;
+    if (!header_value(req.headers, "If-None-Match", v)) return false;
+    return v == "*" || v.find(etag) != std::string_view::npos;
+}
+
+// {"seq":S,"reset":bool,"items":[{"slot":n,"asset":{...}},...]}; the client asks for
+// since_seq=S next and, on reset, replaces its whole table.
+static std::string delta_body(const ServerContext& ctx, uint64_t since, bool keep_alive, ContentEncoding enc) {
+    const AssetStore& store = ctx.store;
+    std::vector<std::pair<size_t, std::shared_ptr<const AssetRecord>>> changed;
+    bool reset = false;
+    const uint64_t seq = store.changes_since(since, changed, &reset);
+    std::string body;
+    body += "{\"seq\":"; body += std::to_string(seq);
+    body += ",\"reset\":"; body += reset ? "true" : "false";
+    body += ",\"items\":[";
+    for (size_t i = 0; i < changed.size(); i++) {
+        if (i) body += ',';
+        body += "{\"slot\":"; body += std::to_string(changed[i].first);
+        body += ",\"asset\":"; body += changed[i].second->json; body += '}';
+    }
+    body += "]}";
+    return http_response_encoded(200, "application/json; charset=utf-8", body, keep_alive, enc, ctx.compression,
+                                 "ETag: " + std::string(Etag(seq, enc).view()) + "\r\n");
+}
+
+static std::string_view cache_key(const HttpRequest& req, ContentEncoding enc) {
+    return req.arena->cat({req.path, "|", encoding_name(enc), req.keep_alive ? "|ka" : "|close"});
+}
+
+// Turns a freshly built 200 response into a cache entry. A streamed body is produced up front
+// as long as it still fits in an entry; past that, the response goes out with the rest streaming.
+static HttpResponse cache_response(ServerContext& ctx, std::string_view key, uint64_t seq, HttpResponse resp) {
+    const size_t limit = ctx.cache.max_entry();
+    if (!limit || resp.close || resp.wire.compare(9, 3, "200") != 0) return resp;
+    if (resp.stream) {
+        while (resp.wire.size() <= limit) {
+            if (!http_stream_piece(resp, resp.wire, 64 * 1024)) { resp.stream.reset(); break; }
+        }
+        if (resp.stream) return resp;
+    }
+    auto wire = std::make_shared<const std::string>(std::move(resp.wire));
+    ctx.cache.put(key, seq, wire);
+    return HttpResponse(std::move(wire));
+}
+
+static void render_histogram(std::string& out, const MetricsTotals& t, MetricHist h, const char* name, const char* labels) {
+    char buf[64];
+    uint64_t cum = 0;
+    for (size_t b = 0; b <= kMetBucketCount; b++) {
+        cum += t.buckets[h][b];
+        if (b < kMetBucketCount) std::snprintf(buf, sizeof(buf), "%g", (double)kMetBucketsNs[b] / 1e9);
+        else std::snprintf(buf, sizeof(buf), "+Inf");
+        out += name; out += "_bucket{"; out += labels; if (*labels) out += ',';
+        out += "le=\""; out += buf; out += "\"} "; out += std::to_string(cum); out += '\n';
+    }
+    std::snprintf(buf, sizeof(buf), "%.9f", (double)t.sum_ns[h] / 1e9);
+    out += name; out += "_sum"; if (*labels) { out += '{'; out += labels; out += '}'; } out += ' '; out += buf; out += '\n';
+    out += name; out += "_count"; if (*labels) { out += '{'; out += labels; out += '}'; } out += ' '; out += std::to_string(cum); out += '\n';
+}
+
+static std::string render_metrics(const ServerContext& ctx) {
+    MetricsTotals t;
+    Metrics::collect(t);
+    std::string out;
+    out.reserve(16 * 1024);
+    auto head = [&](const char* name, const char* type, const char* help) {
+        out += "# HELP "; out += name; out += ' '; out += help; out += '\n';
+        out += "# TYPE "; out += name; out += ' '; out += type; out += '\n';
+    };
+    auto sample = [&](const char* name, uint64_t v) { out += name; out += ' '; out += std::to_string(v); out += '\n'; };
+
+    static const struct { MetricHist h; const char* label; } kRoutes[] = {
+        {kMetRouteIndex, "route=\"GET /\""}, {kMetRouteAssetsGet, "route=\"GET /api/assets\""},
+        {kMetRouteAssetsDelta, "route=\"GET /api/assets?since_seq\""},
+        {kMetRouteExportCsv, "route=\"GET /api/export.csv\""}, {kMetRouteAssetsPost, "route=\"POST /api/assets\""},
+        {kMetRouteAssetsBatch, "route=\"POST /api/assets/batch\""},
+        {kMetRouteStats, "route=\"GET /api/stats\""},
+        {kMetRouteMetrics, "route=\"GET /metrics\""}, {kMetRouteOther, "route=\"other\""},
+    };
+    head("asset_http_request_duration_seconds", "histogram", "Time from a parsed request until its response (or, for streamed bodies, its head) is ready.");
+    for (const auto& r : kRoutes) render_histogram(out, t, r.h, "asset_http_request_duration_seconds", r.label);
+
+    head("asset_http_responses_total", "counter", "Responses by status class.");
+    static const char* const kClasses[] = {"2xx", "3xx", "4xx", "5xx"};
+    for (size_t i = 0; i < 4; i++) {
+        out += "asset_http_responses_total{code=\""; out += kClasses[i]; out += "\"} ";
+        out += std::to_string(t.counters[kMetStatus2xx + i]); out += '\n';
+    }
+    head("asset_http_received_bytes_total", "counter", "Bytes read from client connections.");
+    sample("asset_http_received_bytes_total", t.counters[kMetBytesIn]);
+    head("asset_http_sent_bytes_total", "counter", "Bytes written to client connections.");
+    sample("asset_http_sent_bytes_total", t.counters[kMetBytesOut]);
+    head("asset_connections_opened_total", "counter", "Client connections accepted.");
+    sample("asset_connections_opened_total", t.counters[kMetConnOpened]);
+    head("asset_connections_active", "gauge", "Client connections currently open.");
+    sample("asset_connections_active", t.counters[kMetConnOpened] - std::min(t.counters[kMetConnOpened], t.counters[kMetConnClosed]));
+
+    head("asset_accept_wait_seconds", "histogram", "Time an accepted connection waited in the server before a worker picked it up.");
+    render_histogram(out, t, kMetAcceptWait, "asset_accept_wait_seconds", "");
+    head("asset_request_parse_seconds", "histogram", "Time spent parsing request heads.");
+    render_histogram(out, t, kMetParse, "asset_request_parse_seconds", "");
+    head("asset_record_validate_seconds", "histogram", "Time spent validating posted asset JSON.");
+    render_histogram(out, t, kMetValidate, "asset_record_validate_seconds", "");
+    head("asset_storage_append_seconds", "histogram", "Time per storage batch append, including the sync.");
+    render_histogram(out, t, kMetStorageAppend, "asset_storage_append_seconds", "");
+    head("asset_storage_appended_records_total", "counter", "Records appended to the DB.");
+    sample("asset_storage_appended_records_total", t.counters[kMetRecordsAppended]);
+    head("asset_storage_queue_depth", "gauge", "Records waiting for the storage writer.");
+    sample("asset_storage_queue_depth", ctx.writer.queue_depth());
+    head("asset_response_cache_hits_total", "counter", "Read responses served from the response cache.");
+    sample("asset_response_cache_hits_total", t.counters[kMetCacheHits]);
+    head("asset_response_cache_misses_total", "counter", "Cacheable read responses that had to be built.");
+    sample("asset_response_cache_misses_total", t.counters[kMetCacheMisses]);
+    head("asset_http_rejected_total", "counter", "Requests refused by admission control.");
+    static const struct { MetricCounter c; const char* reason; } kRejects[] = {
+        {kMetRejectRateIp, "rate_ip"}, {kMetRejectRateAgent, "rate_agent"}, {kMetRejectOverload, "overload"},
+        {kMetRejectTooLarge, "too_large"}, {kMetRejectTimeout, "timeout"}, {kMetRejectMalformed, "malformed"},
+        {kMetRejectNotReady, "not_ready"},
+    };
+    for (const auto& r : kRejects) {
+        out += "asset_http_rejected_total{reason=\""; out += r.reason; out += "\"} ";
+        out += std::to_string(t.counters[r.c]); out += '\n';
+    }
+    head("asset_tls_handshakes_total", "counter", "TLS handshakes by result: full, resumed (session ticket or cache) or failed.");
+    static const struct { MetricCounter c; const char* result; } kHandshakes[] = {
+        {kMetTlsFull, "full"}, {kMetTlsResumed, "resumed"}, {kMetTlsFailed, "failed"},
+    };
+    for (const auto& h : kHandshakes) {
+        out += "asset_tls_handshakes_total{result=\""; out += h.result; out += "\"} ";
+        out += std::to_string(t.counters[h.c]); out += '\n';
+    }
+    head("asset_log_dropped_lines_total", "counter", "Log lines dropped because the log output could not keep up.");
+    sample("asset_log_dropped_lines_total", Logger::get().dropped());
+#if defined(ASSET_HEAP_COUNT)
+    head("asset_heap_allocations_total", "counter", "Heap allocations (operator new) made by the whole process.");
+    sample("asset_heap_allocations_total", heap_allocs());
+#endif
+    head("asset_store_records", "gauge", "Assets held in the in-memory index.");
+    sample("asset_store_records", ctx.store.size());
+    char ratio[32];
+    std::snprintf(ratio, sizeof(ratio), "%.4f", ctx.load.ratio());
+    head("asset_load_progress_ratio", "gauge", "Share of the DB read by the startup load (1 once loaded).");
+    out += "asset_load_progress_ratio "; out += ratio; out += '\n';
+    head("asset_load_bytes", "gauge", "Size of the startup load: JSONL bytes, or rows of a columnar DB.");
+    sample("asset_load_bytes", ctx.load.total.load(std::memory_order_relaxed));
+    head("asset_ready", "gauge", "1 once the startup load is done and requests are served.");
+    sample("asset_ready", ctx.load.ready.load(std::memory_order_acquire) ? 1 : 0);
+    head("asset_ready_seconds", "gauge", "Time from process start until ready.");
+    out += "asset_ready_seconds "; out += std::to_string((double)ctx.load.ready_ms.load(std::memory_order_relaxed) / 1000.0); out += '\n';
+    return out;
+}
+
+static void note_handshake(SSL* tls, bool ok) {
+    Metrics::add(!ok ? kMetTlsFailed : tls_resumed(tls) ? kMetTlsResumed : kMetTlsFull);
+}
+
+static void note_response(MetricHist route, std::chrono::steady_clock::time_point t0, const HttpResponse& resp) {
+    const std::string& wire = resp.head();
+    Metrics::observe(route, std::chrono::steady_clock::now() - t0);
+    const char cls = wire.size() > 9 ? wire[9] : '5'; // "HTTP/1.1 201 ..."
+    Metrics::add(cls == '2' ? kMetStatus2xx : cls == '3' ? kMetStatus3xx : cls == '4' ? kMetStatus4xx : kMetStatus5xx);
+}
+
+// Splits a batch body into record texts: a JSON array, or NDJSON (one record per line, blank
+// lines ignored). Records are validated later, one by one; only a malformed array fails here.
+static bool split_batch(std::string_view body, std::vector<std::string_view>& out, std::string* why) {
+    const char* const begin = body.data();
+    const char* const end = begin + body.size();
+    const char* p = json_skip_ws(begin, end);
+    if (p < end && *p == '[') {
+        p = json_skip_ws(p + 1, end);
+        if (p < end && *p == ']') {
+            if (json_skip_ws(p + 1, end) == end) return true;
+            *why = "Trailing data after array";
+            return false;
+        }
+        for (;;) {
+            const char* q = json_skip_value(p, end, 0);
+            if (!q) { *why = "Malformed array element (offset " + std::to_string((long long)(p - begin)) + ")"; return false; }
+            out.emplace_back(p, (size_t)(q - p));
+            p = json_skip_ws(q, end);
+            if (p < end && *p == ',') { p = json_skip_ws(p + 1, end); continue; }
+            if (p < end && *p == ']' && json_skip_ws(p + 1, end) == end) return true;
+            *why = "Expected ',' or ']' (offset " + std::to_string((long long)(p - begin)) + ")";
+            return false;
+        }
+    }
+    while (!body.empty()) {
+        const size_t nl = body.find('\n');
+        std::string_view line = body.substr(0, nl);
+        body = nl == std::string_view::npos ? std::string_view() : body.substr(nl + 1);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (json_skip_ws(line.data(), line.data() + line.size()) == line.data() + line.size()) continue;
+        out.push_back(line);
+    }
+    return true;
+}
+
+// POST /api/assets/batch: every valid record goes to storage as one unit; the reply lists a
+// status per record, in input order.
+static HttpResponse handle_batch(ServerContext& ctx, const HttpRequest& req, const ReplyLater& reply_later,
+                                 std::chrono::steady_clock::time_point t0) {
+    const bool ka = req.keep_alive;
+    std::vector<std::string_view> items;
+    std::string why;
+    if (!split_batch(req.body, items, &why)) {
+        return http_response(400, "application/json; charset=utf-8", "{\"error\":\"" + json_escape(why) + "\"}", ka);
+    }
+
+    std::vector<std::shared_ptr<const AssetRecord>> recs;
+    recs.reserve(items.size());
+    std::vector<std::string> logs;
+    std::vector<std::shared_ptr<const AssetRecord>> bases;
+    std::vector<size_t> rec_item; // input index of recs[i]
+    std::vector<std::tuple<size_t, int, std::string>> rejected; // input index, status, reason
+    PendingRecords pending; // so a change can build on an earlier item of the same batch
+    std::shared_ptr<const AssetRecord> rec, base;
+    bool change;
+    int retry;
+    const auto v0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < items.size(); i++) {
+        if (const int code = resolve_record(ctx.store, items[i], rec, &change, &why, &pending, nullptr, &base)) {
+            rejected.emplace_back(i, code, std::move(why));
+            continue;
+        }
+        if (ctx.rate_agent.enabled() && !ctx.rate_agent.allow(ctx.store.key_value(rec->id, rec->hostname), &retry)) {
+            Metrics::add(kMetRejectRateAgent);
+            rejected.emplace_back(i, 429, "rate limit exceeded for this agent");
+            continue;
+        }
+        if (change) {
+            logs.resize(recs.size());
+            logs.emplace_back(items[i]);
+            bases.resize(recs.size());
+            bases.push_back(std::move(base));
+        }
+        pending[ctx.store.key_of(rec->id, rec->hostname)] = rec;
+        recs.push_back(std::move(rec));
+        rec_item.push_back(i);
+    }
+    Metrics::observe(kMetValidate, std::chrono::steady_clock::now() - v0);
+
+    // {"accepted":n,"rejected":m,"results":[{"index":i,"status":201|400|409|500[,"error":...]},...]}
+    auto reply = [ka, enc = response_encoding(ctx, req), opt = &ctx.compression, total = items.size(),
+                  rejected = std::move(rejected), rec_item = std::move(rec_item)](bool stored, const std::vector<size_t>& stale) mutable {
+        for (size_t k : stale) rejected.emplace_back(rec_item[k], 409, kStaleChange);
+        if (!stale.empty()) std::sort(rejected.begin(), rejected.end(), [](const auto& a, const auto& b) { return std::get<0>(a) < std::get<0>(b); });
+        const size_t accepted = stored ? total - rejected.size() : 0;
+        std::string body;
+        body.reserve(64 + total * 28);
+        body += "{\"accepted\":"; body += std::to_string(accepted);
+        body += ",\"rejected\":"; body += std::to_string(total - accepted);
+        body += ",\"results\":[";
+        size_t r = 0;
+        for (size_t i = 0; i < total; i++) {
+            if (i) body += ',';
+            body += "{\"index\":"; body += std::to_string(i);
+            if (r < rejected.size() && std::get<0>(rejected[r]) == i) {
+                body += ",\"status\":"; body += std::to_string(std::get<1>(rejected[r]));
+                body += ",\"error\":\""; body += json_escape(std::get<2>(rejected[r++])); body += "\"}";
+            } else if (stored) {
+                body += ",\"status\":201}";
+            } else {
+                body += ",\"status\":500,\"error\":\"storage write failed\"}";
+            }
+        }
+        body += "]}";
+        const int code = !stored ? 500 : accepted == 0 && total > 0 ? 400 : 200;
+        return http_response_encoded(code, "application/json; charset=utf-8", body, ka, enc, *opt);
+    };
+
+    if (recs.empty()) return reply(true, {});
+    ctx.ingest_inflight++;
+    ServerContext* c = &ctx;
+    ctx.writer.submit_batch(std::move(recs), [later = reply_later.make(), reply = std::move(reply), t0, c](bool ok, const std::vector<size_t>& stale) mutable {
+        c->ingest_inflight--;
+        HttpResponse resp = reply(ok, stale);
+        note_response(kMetRouteAssetsBatch, t0, resp);
+        later(std::move(resp));
+    }, std::move(logs), std::move(bases));
+    return HttpResponse();
+}
+
+// Every poller woken by the same change asks for the same since_seq, so the reply is built once.
+static HttpResponse delta_reply(ServerContext& ctx, uint64_t since, bool keep_alive, ContentEncoding enc) {
+    const std::string key = "delta " + std::to_string(since) + '|' + encoding_name(enc) + (keep_alive ? "|ka" : "|close");
+    const uint64_t seq = ctx.store.seq();
+    if (auto hit = ctx.cache.get(key, seq)) return HttpResponse(std::move(hit));
+    return cache_response(ctx, key, seq, delta_body(ctx, since, keep_alive, enc));
+}
+
+// GET /api/assets?since_seq=N[&wait=S]. With `wait`, a request that has nothing new yet is
+// held (long poll) until the store changes or S seconds pass.
+static HttpResponse delta_response(ServerContext& ctx, const HttpRequest& req, std::string_view qs,
+                                   const ReplyLater& reply_later, std::chrono::steady_clock::time_point t0) {
+    const bool ka = req.keep_alive;
+    std::string v;
+    unsigned long long since = 0, wait = 0;
+    query_param(qs, "since_seq", v);
+    if (!parse_uint(v, ULLONG_MAX, &since) || (query_param(qs, "wait", v) && !parse_uint(v, kMaxPollWaitSec, &wait))) {
+        return http_response(400, "application/json; charset=utf-8",
+                             "{\"error\":\"since_seq must be a sequence number, wait at most " + std::to_string(kMaxPollWaitSec) + " seconds\"}", ka);
+    }
+    const ContentEncoding enc = response_encoding(ctx, req);
+    if (wait == 0 || ctx.store.seq() != since) return delta_reply(ctx, since, ka, enc);
+
+    ServerContext* c = &ctx;
+    ctx.feed.park(since, t0 + std::chrono::seconds(wait), [c, since, ka, enc, later = reply_later.make(), t0] {
+        HttpResponse resp = delta_reply(*c, since, ka, enc);
+        note_response(kMetRouteAssetsDelta, t0, resp);
+        later(std::move(resp));
+    });
+    return HttpResponse();
+}
+
+// Routes one request; sets `route` for the metrics. Returns an empty response when the
+// handler kept `later` (the deferred path records its own metrics).
+static HttpResponse route_request(ServerContext& ctx, const HttpRequest& req, const ReplyLater& later,
+                                  std::chrono::steady_clock::time_point t0, MetricHist& route) {
+    const std::string_view method = req.method;
+    const size_t qmark = req.path.find('?');
+    const std::string_view path = req.path.substr(0, qmark);
+    const std::string_view query = qmark == std::string_view::npos ? std::string_view() : req.path.substr(qmark + 1);
+    const std::string_view body = req.body;
+    const bool ka = req.keep_alive;
+
+    // Listening starts before the DB is loaded, so probes can watch the load; everything that
+    // reads or writes assets waits for it.
+    const bool ready = ctx.load.ready.load(std::memory_order_acquire);
+    if (method == "GET" && path == "/readyz") {
+        if (ready) return http_response(200, "application/json; charset=utf-8", "{\"ready\":true}", ka, "Cache-Control: no-store\r\n");
+        char progress[64];
+        std::snprintf(progress, sizeof(progress), "{\"ready\":false,\"progress\":%.4f}", ctx.load.ratio());
+        return http_response(503, "application/json; charset=utf-8", progress, ka, "Cache-Control: no-store\r\nRetry-After: 1\r\n");
+    }
+    if (!ready && !(method == "GET" && path == "/metrics")) {
+        Metrics::add(kMetRejectNotReady);
+        return refusal(503, "Loading assets, not ready yet", ka, 1);
+    }
+
+    if (method == "GET" && (path == "/" || path == "/index.html")) {
+        route = kMetRouteIndex;
+        const ContentEncoding enc = response_encoding(ctx, req);
+        const std::string& packed = enc == kEncGzip ? ctx.html_gzip : ctx.html_deflate;
+        if (enc == kEncIdentity || packed.empty()) return http_response(200, "text/html; charset=utf-8", ctx.html, ka, "Vary: Accept-Encoding\r\n");
+        return http_response(200, "text/html; charset=utf-8", packed, ka,
+                             std::string("Vary: Accept-Encoding\r\nContent-Encoding: ") + encoding_name(enc) + "\r\n");
+    }
+
+    if (method == "GET" && path == "/metrics") {
+        route = kMetRouteMetrics;
+        return http_response_encoded(200, "text/plain; version=0.0.4; charset=utf-8", render_metrics(ctx), ka,
+                                     response_encoding(ctx, req), ctx.compression);
+    }
+
+    if (method == "GET" && path == "/api/stats") {
+        route = kMetRouteStats;
+        return stats_response(ctx, req, query);
+    }
+
+    if (method == "GET" && (path == "/api/assets" || path == "/api/export.csv")) {
+        const bool csv = path == "/api/export.csv";
+        route = csv ? kMetRouteExportCsv : kMetRouteAssetsGet;
+        std::string since;
+        if (!csv && query_param(query, "since_seq", since)) {
+            route = kMetRouteAssetsDelta;
+            return delta_response(ctx, req, query, later, t0);
+        }
+        // Taken before reading: the body is at least this fresh, so a later match is safe.
+        const ContentEncoding enc = response_encoding(ctx, req);
+        const uint64_t seq = ctx.store.seq();
+        const Etag etag(seq, enc);
+        if (etag_matches(req, etag.view())) {
+            return http_head(304, csv ? "text/csv; charset=utf-8" : "application/json; charset=utf-8", -1, ka, false,
+                             req.arena->cat({"ETag: ", etag.view(), "\r\nVary: Accept-Encoding\r\n"}));
+        }
+        const std::string_view key = cache_key(req, enc);
+        if (auto hit = ctx.cache.get(key, seq)) return HttpResponse(std::move(hit));
+        const std::string extra = "ETag: " + std::string(etag.view()) + "\r\n";
+        const int level = ctx.compression.level;
+        AssetQuery q;
+        std::vector<size_t> fields;
+        bool filtered;
+        std::string why;
+        HttpResponse resp;
+        if (!build_asset_query(query, csv, q, fields, &filtered, &why)) {
+            return http_response(400, "application/json; charset=utf-8", "{\"error\":\"" + json_escape(why) + "\"}", ka);
+        }
+        if (filtered) resp = query_response(ctx, req, q, std::move(fields), csv, extra);
+        else if (csv) resp = stream_response(req, "text/csv; charset=utf-8", std::unique_ptr<BodyStream>(new AssetCsvStream(ctx.store)), extra, enc, level);
+        else resp = stream_response(req, "application/json; charset=utf-8", std::unique_ptr<BodyStream>(new AssetJsonStream(ctx.store)), extra, enc, level);
+        return cache_response(ctx, key, seq, std::move(resp));
+    }
+
+    if (method == "POST" && path == "/api/assets") {
+        route = kMetRouteAssetsPost;
+        if (ingest_overloaded(ctx)) {
+            Metrics::add(kMetRejectOverload);
+            return refusal(503, "storage is saturated, retry later", ka, 1);
+        }
+        std::string why;
+        std::shared_ptr<const AssetRecord> rec, base;
+        bool change;
+        const auto v0 = std::chrono::steady_clock::now();
+        const int code = resolve_record(ctx.store, body, rec, &change, &why, nullptr, nullptr, &base);
+        Metrics::observe(kMetValidate, std::chrono::steady_clock::now() - v0);
+        if (code) {
+            return http_response(code, "application/json; charset=utf-8", std::string("{\"error\":\"") + json_escape(why) + "\"}", ka);
+        }
+        int retry;
+        if (ctx.rate_agent.enabled() && !ctx.rate_agent.allow(ctx.store.key_value(rec->id, rec->hostname), &retry)) {
+            Metrics::add(kMetRejectRateAgent);
+            return refusal(429, "rate limit exceeded for this agent", ka, retry);
+        }
+
+        ctx.ingest_inflight++;
+        ServerContext* c = &ctx;
+        ctx.writer.submit(std::move(rec), [later = later.make(), ka, t0, c](bool ok, const std::vector<size_t>& stale) {
+            c->ingest_inflight--;
+            HttpResponse resp = !ok ? http_response(500, "application/json; charset=utf-8", "{\"error\":\"storage write failed\"}", ka)
+                              : !stale.empty() ? http_response(409, "application/json; charset=utf-8", "{\"error\":\"" + json_escape(kStaleChange) + "\"}", ka)
+                              : HttpResponse(ka ? kAckCreated.keep_alive : kAckCreated.close);
+            note_response(kMetRouteAssetsPost, t0, resp);
+            later(std::move(resp));
+        }, change ? std::string(body) : std::string(), std::move(base));
+        return HttpResponse();
+    }
+
+    if (method == "POST" && path == "/api/assets/batch") {
+        route = kMetRouteAssetsBatch;
+        if (ingest_overloaded(ctx)) {
+            Metrics::add(kMetRejectOverload);
+            return refusal(503, "storage is saturated, retry later", ka, 1);
+        }
+        return handle_batch(ctx, req, later, t0);
+    }
+
+    return http_response(404, "application/json; charset=utf-8", "{\"error\":\"not found\"}", ka);
+}
+
+// Per-thread xorshift, so sampling decisions share no state between workers.
+static bool sample_hit(double rate) {
+    thread_local uint64_t x = 0x9E3779B97F4A7C15ull ^ (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    return (double)(x >> 11) * (1.0 / 9007199254740992.0) < rate;
+}
+
+static void access_log(std::string_view method, std::string_view path, std::string_view peer, const HttpResponse& resp,
+                       std::chrono::steady_clock::time_point t0) {
+    const std::string& head = resp.head();
+    const std::string status = head.size() >= 12 ? head.substr(9, 3) : std::string("000");
+    const std::string us = std::to_string((long long)std::chrono::duration_cast<std::chrono::microseconds>(
+                                              std::chrono::steady_clock::now() - t0).count());
+    if (Logger::get().json()) {
+        Logger::get().write(kLogInfo, "access", "\"method\":\"" + json_escape(std::string(method)) + "\",\"path\":\"" +
+                                                json_escape(std::string(path)) + "\",\"status\":" + status + ",\"us\":" + us +
+                                                ",\"peer\":\"" + std::string(peer) + "\"");
+    } else {
+        Logger::get().write(kLogInfo, "access " + std::string(method) + " " + std::string(path) + " " + status + " " + us + "us " +
+                                          std::string(peer));
+    }
+}
+
+// For a sampled request: the access log line is written as the deferred reply goes out.
+struct LoggedReply : ReplyLater {
+    const ReplyLater& inner;
+    const HttpRequest& req;
+    std::chrono::steady_clock::time_point t0;
+
+    LoggedReply(const ReplyLater& i, const HttpRequest& r, std::chrono::steady_clock::time_point t) : inner(i), req(r), t0(t) {}
+    DeferredReply make() const override {
+        return [later = inner.make(), method = std::string(req.method), path = std::string(req.path),
+                peer = std::string(req.peer), t0 = t0](HttpResponse r) {
+            access_log(method, path, peer, r, t0);
+            later(std::move(r));
+        };
+    }
+};
+
+// Returns the response, or an empty one when the handler kept `later` and will deliver
+// the response through it.
+static HttpResponse handle_request(ServerContext& ctx, const HttpRequest& req, const ReplyLater& later) {
+    const auto t0 = std::chrono::steady_clock::now();
+    MetricHist route = kMetRouteOther;
+    // Sampled up front, so unsampled requests pay nothing for the access log.
+    const bool logged = ctx.access_log_sample > 0 && log_enabled(kLogInfo) && sample_hit(ctx.access_log_sample);
+    int retry;
+    HttpResponse resp;
+    if (ctx.rate_ip.enabled() && !ctx.rate_ip.allow(req.peer, &retry)) {
+        Metrics::add(kMetRejectRateIp);
+        resp = refusal(429, "rate limit exceeded for this address", req.keep_alive, retry);
+    } else if (logged) {
+        resp = route_request(ctx, req, LoggedReply(later, req, t0), t0, route);
+    } else {
+        resp = route_request(ctx, req, later, t0, route);
+    }
+    if (!resp.empty()) {
+        note_response(route, t0, resp);
+        if (logged) access_log(req.method, req.path, req.peer, resp, t0);
+    }
+    return resp;
+}
+
+static int open_listener(int port, bool reuse_port, int backlog) {
+    int fd = (int)socket(AF_INET, SOCK_STREAM, 0);
+#if defined(_WIN32)
+    if (fd == (int)INVALID_SOCKET) { log_err("socket() failed."); return -1; }
+#else
+    if (fd < 0) { log_err("socket() failed."); return -1; }
+#endif
+
+    int opt = 1;
+    setsockopt((SOCKET)fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+#if defined(SO_REUSEPORT)
+    if (reuse_port && setsockopt((SOCKET)fd, SOL_SOCKET, SO_REUSEPORT, (char*)&opt, sizeof(opt)) != 0) {
+        close_socket(fd);
+        return -1;
+    }
+#else
+    if (reuse_port) { close_socket(fd); return -1; }
+#endif
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+
+    if (bind((SOCKET)fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        int e = last_sock_err();
+        log_err("bind() failed: " + err_text(e));
+        close_socket(fd);
+        return -1;
+    }
+
+    if (listen((SOCKET)fd, backlog) != 0) {
+        int e = last_sock_err();
+        log_err("listen() failed: " + err_text(e));
+        close_socket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#if !defined(__linux__)
+// A deferred reply on the blocking path: the connection thread waits until it is handed over.
+struct BlockingReply : ReplyLater {
+    struct State {
+        std::mutex mu;
+        std::condition_variable cv;
+        HttpResponse resp;
+        bool ready = false;
+    };
+    State* st;
+
+    explicit BlockingReply(State* s) : st(s) {}
+    DeferredReply make() const override {
+        return [s = st](HttpResponse r) {
+            std::lock_guard<std::mutex> lk(s->mu);
+            s->resp = std::move(r);
+            s->ready = true;
+            s->cv.notify_one();
+        };
+    }
+};
+
+// Blocking keep-alive handler, used by the portable worker pool.
+static void serve_blocking_connection(ServerContext& ctx, int cfd, const std::string& peer) {
+    set_socket_timeouts(cfd, ctx.idle_timeout_ms);
+    SSL* tls = nullptr;
+    if (ctx.tls) {
+        bool want_write;
+        tls = ctx.tls->accept(cfd);
+        const bool ok = tls && tls_handshake(tls, &want_write) == 1; // blocking: done or failed
+        note_handshake(tls, ok);
+        if (!ok) {
+            tls_close(tls);
             close_socket(cfd);
+            Metrics::add(kMetConnClosed);
+            return;
+        }
+    }
+    std::string data;
+    RequestArena arena;
+    HttpRequest req;
+    req.peer = peer;
+    req.arena = &arena;
+    auto req_start = std::chrono::steady_clock::now();
+    for (;;) {
+        const auto p0 = std::chrono::steady_clock::now();
+        size_t used;
+        int rc = parse_request(data, req, ctx.admission, &used);
+        if (rc < 0) { send_all(cfd, parse_refusal(rc), tls); break; }
+        if (rc == 0) {
+            // Checked between reads only: a client that stops sending altogether hits the idle timeout.
+            if (!data.empty() && request_overdue(ctx.admission, data, req_start, p0)) { send_all(cfd, timeout_refusal(), tls); break; }
+            char buf[16384];
+            int n = sock_recv(cfd, tls, buf, sizeof(buf));
+            if (n <= 0) break;
+            Metrics::add(kMetBytesIn, (uint64_t)n);
+            if (data.empty()) req_start = std::chrono::steady_clock::now();
+            data.append(buf, buf + n);
+            continue;
+        }
+        req_start = std::chrono::steady_clock::now();
+        Metrics::observe(kMetParse, std::chrono::steady_clock::now() - p0);
+        BlockingReply::State deferred;
+        HttpResponse resp = handle_request(ctx, req, BlockingReply(&deferred));
+        if (resp.empty()) {
+            std::unique_lock<std::mutex> lk(deferred.mu);
+            deferred.cv.wait(lk, [&]{ return deferred.ready; });
+            resp = std::move(deferred.resp);
+        }
+        const bool keep_alive = req.keep_alive;
+        arena.reset();
+        data.erase(0, used); // the request's views end here
+        bool ok = send_all(cfd, resp.head(), tls);
+        if (ok) Metrics::add(kMetBytesOut, resp.head().size());
+        if (ok && resp.stream) {
+            std::string out;
+            bool more = true;
+            while (ok && more) {
+                out.clear();
+                more = http_stream_piece(resp, out, 64 * 1024);
+                ok = send_all(cfd, out, tls);
+                if (ok) Metrics::add(kMetBytesOut, out.size());
+            }
+        }
+        if (!ok || !keep_alive || resp.close) break;
+    }
+    tls_close(tls);
+    close_socket(cfd);
+    Metrics::add(kMetConnClosed);
+}
+#endif
+
+#if defined(__linux__)
+// ------------------------------
+// epoll reactor (Linux): one event loop per worker thread
+// ------------------------------
+static const size_t kMaxPendingOut = 4u << 20; // stop answering pipelined requests until the client reads
+static const size_t kMaxInFlight = 256;        // responses queued per connection
+static const size_t kStreamHighWater = 256 * 1024; // streamed bodies are produced only up to this much unsent output
+
+struct ReactorConn {
+    uint64_t id = 0; // distinguishes this connection from a later one that reuses the fd
+    std::string in;     // received bytes; requests are parsed in place and handled as views into it
+    size_t in_off = 0;  // start of the bytes not yet consumed by a request
+    RequestArena arena; // scratch for the request being handled
+    std::string out;
+    size_t out_off = 0;
+    std::shared_ptr<const std::string> out_shared; // cached response sent as is; `out` is empty meanwhile
+    bool close_after = false;
+    bool want_write = false;
+    bool peer_closed = false;
+    bool read_paused = false; // input not polled until queued responses and output drain
+    bool armed_read = true;   // whether the fd is currently registered for input
+    // Responses in request order. Slot i answers request number pending_base + i; a slot is
+    // sent once it is ready and everything before it has been sent (deferred storage acks and
+    // streamed bodies keep later pipelined responses waiting behind them).
+    struct Slot { bool ready; HttpResponse resp; };
+    std::deque<Slot> pending;
+    uint64_t pending_base = 0;
+    std::chrono::steady_clock::time_point last_active;
+    std::chrono::steady_clock::time_point req_start; // first byte of the request being received
+    std::string peer;
+    SSL* tls = nullptr;       // HTTPS: all reads and writes go through it
+    bool handshaking = false; // TLS handshake not finished yet; req_start is when it began
+
+    size_t unsent() const { return (out_shared ? out_shared->size() : out.size()) - out_off; }
+    std::string_view unparsed() const { return std::string_view(in).substr(in_off); }
+};
+
+struct ReactorWorker {
+    ServerContext* ctx = nullptr;
+    int ep = -1;
+    int wake_fd = -1; // eventfd signalled when deferred responses are ready
+    uint64_t next_id = 1;
+    std::unordered_map<int, ReactorConn> conns;
+
+    struct Completion { int fd; uint64_t id; uint64_t seq; HttpResponse resp; };
+    std::mutex done_mu;
+    std::vector<Completion> done;
+
+    void complete(int fd, uint64_t id, uint64_t seq, HttpResponse resp) {
+        {
+            std::lock_guard<std::mutex> lk(done_mu);
+            done.push_back(Completion{fd, id, seq, std::move(resp)});
+        }
+        uint64_t one = 1;
+        ssize_t w = ::write(wake_fd, &one, sizeof(one));
+        (void)w;
+    }
+};
+
+static void reactor_close(ReactorWorker& w, int fd) {
+    auto it = w.conns.find(fd);
+    if (it != w.conns.end()) tls_close(it->second.tls);
+    epoll_ctl(w.ep, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    w.conns.erase(fd);
+    Metrics::add(kMetConnClosed);
+}
+
+// Re-arms the fd for the events the connection currently cares about. Once the peer
+// has half-closed, input is no longer polled (EPOLLRDHUP would otherwise fire forever);
+// neither is it while reading is paused.
+static void reactor_watch(int ep, int fd, ReactorConn& c, bool want_write, bool force = false) {
+    const bool read = !c.peer_closed && !c.read_paused;
+    if (c.want_write == want_write && c.armed_read == read && !force) return;
+    c.want_write = want_write;
+    c.armed_read = read;
+    epoll_event ev{};
+    ev.events = (read ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u) | (want_write ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.fd = fd;
+    epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+}
+
+// Moves ready responses, in order, into the output buffer. A streamed body is produced only
+// while the unsent output stays under the high-water mark. A shared (cached) response is sent
+// straight from its buffer once everything before it is out. Returns true while a response
+// still has more to produce.
+static bool reactor_fill(ReactorConn& c) {
+    while (!c.pending.empty() && c.pending.front().ready) {
+        if (c.out_shared) return true;
+        HttpResponse& r = c.pending.front().resp;
+        if (r.shared) {
+            if (c.unsent()) return true;
+            c.out.clear();
+            c.out_off = 0;
+            c.out_shared = std::move(r.shared);
+            c.pending.pop_front();
+            c.pending_base++;
+            return !c.pending.empty();
+        }
+        if (!r.wire.empty()) { c.out += r.wire; r.wire.clear(); }
+        if (r.stream) {
+            while (c.unsent() < kStreamHighWater) {
+                if (!http_stream_piece(r, c.out, 64 * 1024)) { r.stream.reset(); break; }
+            }
+            if (r.stream) return true;
+        }
+        if (r.close) c.close_after = true;
+        c.pending.pop_front();
+        c.pending_base++;
+    }
+    return false;
+}
+
+// Writes as much pending output as the socket takes. Returns false once the connection is done.
+static bool reactor_flush(int ep, int fd, ReactorConn& c) {
+    const std::string& buf = c.out_shared ? *c.out_shared : c.out;
+    while (c.out_off < buf.size()) {
+        ssize_t n = sock_send(fd, c.tls, buf.data() + c.out_off, buf.size() - c.out_off);
+        if (n > 0) { c.out_off += (size_t)n; Metrics::add(kMetBytesOut, (uint64_t)n); continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!c.out_shared && c.out_off > c.out.size() / 2) { c.out.erase(0, c.out_off); c.out_off = 0; }
+            reactor_watch(ep, fd, c, true);
+            return true;
+        }
+        return false;
+    }
+    c.out.clear();
+    c.out_shared.reset();
+    c.out_off = 0;
+    reactor_watch(ep, fd, c, false);
+    return !(c.close_after && c.pending.empty());
+}
+
+// Queues a final response (a refused request); nothing after it is read.
+static void reactor_refuse(ReactorConn& c, std::string resp) {
+    c.pending.push_back(ReactorConn::Slot{true, HttpResponse(std::move(resp))});
+    c.close_after = true;
+    c.in.clear();
+    c.in_off = 0;
+}
+
+// The DeferredReply of a reactor request: completes slot `seq` of connection `id` on `fd`.
+struct ReactorReply : ReplyLater {
+    ReactorWorker* w;
+    int fd;
+    uint64_t id, seq;
+
+    ReactorReply(ReactorWorker* w_, int fd_, uint64_t id_, uint64_t seq_) : w(w_), fd(fd_), id(id_), seq(seq_) {}
+    DeferredReply make() const override {
+        return [w = w, fd = fd, id = id, seq = seq](HttpResponse r) { w->complete(fd, id, seq, std::move(r)); };
+    }
+};
+
+// Answers every complete (possibly pipelined) request buffered on `c`, in order.
+static void reactor_process(ReactorWorker& w, int fd, ReactorConn& c, HttpRequest& req) {
+    while (!c.close_after && c.pending.size() < kMaxInFlight && c.unsent() < kMaxPendingOut) {
+        const auto p0 = std::chrono::steady_clock::now();
+        size_t used;
+        int rc = parse_request(c.unparsed(), req, w.ctx->admission, &used);
+        if (rc == 0) break;
+        if (rc < 0) { reactor_refuse(c, parse_refusal(rc)); break; }
+        c.req_start = p0;
+        req.peer = c.peer;
+        req.arena = &c.arena;
+        Metrics::observe(kMetParse, std::chrono::steady_clock::now() - p0);
+        HttpResponse resp = handle_request(*w.ctx, req, ReactorReply(&w, fd, c.id, c.pending_base + c.pending.size()));
+        const bool ready = !resp.empty();
+        c.pending.push_back(ReactorConn::Slot{ready, std::move(resp)});
+        if (!req.keep_alive) c.close_after = true;
+        // The request's views die here; its bytes and scratch are reused.
+        c.arena.reset();
+        c.in_off += used;
+        if (c.in_off == c.in.size()) { c.in.clear(); c.in_off = 0; }
+    }
+}
+
+// Marks a deferred response as ready.
+static void reactor_settle(ReactorConn& c, uint64_t seq, HttpResponse resp) {
+    if (seq < c.pending_base || seq - c.pending_base >= c.pending.size()) return;
+    auto& slot = c.pending[(size_t)(seq - c.pending_base)];
+    slot.ready = true;
+    slot.resp = std::move(resp);
+}
+
+// True while the connection should not be read: it takes no more requests, too many responses
+// are queued, the client is not reading its output, or more bytes wait unparsed than one request
+// may span. Further input then stays in the socket buffers, where TCP flow control holds the
+// client back, instead of growing `in`.
+static bool reactor_input_full(const AdmissionOptions& lim, const ReactorConn& c) {
+    return c.close_after || c.pending.size() >= kMaxInFlight || c.unsent() >= kMaxPendingOut ||
+           c.unparsed().size() >= lim.max_header_bytes + lim.max_body_bytes;
+}
+
+// Reads what the socket has, up to reactor_input_full(). Returns bytes read.
+static size_t reactor_read(const AdmissionOptions& lim, int ep, int fd, ReactorConn& c, std::chrono::steady_clock::time_point now) {
+    if (c.in_off) { c.in.erase(0, c.in_off); c.in_off = 0; } // a partial request stays at the front
+    char buf[16384];
+    size_t got = 0;
+    while (!reactor_input_full(lim, c)) {
+        ssize_t r = sock_recv(fd, c.tls, buf, sizeof(buf));
+        if (r > 0) {
+            if (c.in.empty()) c.req_start = now;
+            c.in.append(buf, (size_t)r);
+            got += (size_t)r;
             continue;
         }
+        if (r == 0) { c.peer_closed = true; break; }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) c.peer_closed = true;
+        break;
+    }
+    if (got) Metrics::add(kMetBytesIn, got);
+    if (c.peer_closed) reactor_watch(ep, fd, c, c.want_write, true);
+    return got;
+}
 
-        if (method == "GET" && path == "/api/assets") {
-            std::ifstream in(db_path, std::ios::in);
-            std::ostringstream out;
-            out << "[";
-            bool first = true;
-            std::string line;
-            while (std::getline(in, line)) {
-                if (line.empty()) continue;
-                if (!first) out << ",";
-                out << line;
-                first = false;
-            }
-            out << "]";
-            std::string resp = http_response(200, "application/json; charset=utf-8", out.str());
-            send_all(cfd, resp);
-            close_socket(cfd);
+// Runs request processing and output until the connection blocks; closes it when finished.
+// Reading pauses while reactor_input_full() holds and resumes once output drains.
+static void reactor_pump(ReactorWorker& w, int fd, ReactorConn& c, HttpRequest& req) {
+    const AdmissionOptions& lim = w.ctx->admission;
+    for (int round = 0; ; round++) {
+        const size_t before = c.unparsed().size();
+        reactor_process(w, fd, c, req);
+        const bool streaming = reactor_fill(c);
+        if (!reactor_flush(w.ep, fd, c)) { reactor_close(w, fd); return; }
+        if (c.want_write) break;
+        if (streaming) {
+            // Socket drained and a body still has more: keep going, but yield to other
+            // connections now and then (EPOLLOUT fires again right away).
+            if (round >= 16) { reactor_watch(w.ep, fd, c, true); break; }
             continue;
         }
+        if (c.unparsed().size() != before) continue;
+        // Input that arrived while paused is in the socket (epoll reports it once re-armed),
+        // but TLS may hold a decrypted remainder only another read can collect.
+        if (reactor_input_full(lim, c) || c.peer_closed || !tls_buffered(c.tls)) break;
+        if (!reactor_read(lim, w.ep, fd, c, std::chrono::steady_clock::now())) break;
+    }
+    if (c.peer_closed && !c.unsent() && c.pending.empty()) { reactor_close(w, fd); return; }
+    c.read_paused = reactor_input_full(lim, c);
+    reactor_watch(w.ep, fd, c, c.want_write);
+}
 
-        if (method == "GET" && path == "/api/export.csv") {
-            auto pick = [](const std::string& json, const char* key)->std::string{
-                std::string k = "\""; k += key; k += "\":";
-                auto pos = json.find(k);
-                if (pos == std::string::npos) return "";
-                pos += k.size();
-                while (pos < json.size() && (json[pos] == ' ')) pos++;
-                if (pos < json.size() && json[pos] == '"') {
-                    pos++;
-                    auto end = json.find('"', pos);
-                    if (end == std::string::npos) return "";
-                    return json.substr(pos, end - pos);
-                } else {
-                    auto end = json.find_first_of(",}", pos);
-                    if (end == std::string::npos) end = json.size();
-                    return json.substr(pos, end - pos);
+static void reactor_worker(ServerContext& ctx, int listen_fd, bool shared_listener) {
+    ReactorWorker w;
+    w.ctx = &ctx;
+    w.ep = epoll_create1(EPOLL_CLOEXEC);
+    if (w.ep < 0) { log_err("epoll_create1() failed: " + err_text(errno)); return; }
+    w.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w.wake_fd < 0) { log_err("eventfd() failed: " + err_text(errno)); close(w.ep); return; }
+
+    epoll_event lev{};
+    lev.events = EPOLLIN;
+#if defined(EPOLLEXCLUSIVE)
+    // Several loops waiting on one shared listener: wake only one of them per connection.
+    if (shared_listener) lev.events |= EPOLLEXCLUSIVE;
+#else
+    (void)shared_listener;
+#endif
+    lev.data.fd = listen_fd;
+    epoll_event wev{};
+    wev.events = EPOLLIN;
+    wev.data.fd = w.wake_fd;
+    if (epoll_ctl(w.ep, EPOLL_CTL_ADD, listen_fd, &lev) != 0 || epoll_ctl(w.ep, EPOLL_CTL_ADD, w.wake_fd, &wev) != 0) {
+        log_err("epoll_ctl() failed: " + err_text(errno));
+        close(w.wake_fd);
+        close(w.ep);
+        return;
+    }
+
+    std::vector<epoll_event> events(256);
+    std::vector<ReactorWorker::Completion> ready;
+    HttpRequest req;
+    const auto idle_limit = std::chrono::milliseconds(ctx.idle_timeout_ms);
+    const auto handshake_limit = std::chrono::milliseconds(ctx.admission.header_timeout_ms);
+    auto last_sweep = std::chrono::steady_clock::now();
+
+    for (;;) {
+        int n = epoll_wait(w.ep, events.data(), (int)events.size(), 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_err("epoll_wait() failed: " + err_text(errno));
+            break;
+        }
+        const auto now = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < n; i++) {
+            const int fd = events[i].data.fd;
+            const uint32_t evs = events[i].events;
+
+            if (fd == listen_fd) {
+                for (;;) {
+                    sockaddr_storage sa{};
+                    socklen_t salen = sizeof(sa);
+                    int cfd = accept4(listen_fd, (sockaddr*)&sa, &salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (cfd < 0) break; // EAGAIN (drained, or another loop won the race) or transient error
+                    epoll_event cev{};
+                    cev.events = EPOLLIN | EPOLLRDHUP;
+                    cev.data.fd = cfd;
+                    if (epoll_ctl(w.ep, EPOLL_CTL_ADD, cfd, &cev) != 0) { close(cfd); continue; }
+                    ReactorConn& c = w.conns[cfd];
+                    c = ReactorConn{};
+                    c.id = w.next_id++;
+                    c.last_active = now;
+                    c.peer = sockaddr_ip((sockaddr*)&sa);
+                    if (ctx.tls) {
+                        c.tls = ctx.tls->accept(cfd);
+                        if (!c.tls) { epoll_ctl(w.ep, EPOLL_CTL_DEL, cfd, nullptr); close(cfd); w.conns.erase(cfd); continue; }
+                        c.handshaking = true;
+                        c.req_start = now;
+                    }
+                    Metrics::add(kMetConnOpened);
+                    // Only the user-space part is visible here: events handled earlier in this batch.
+                    Metrics::observe(kMetAcceptWait, std::chrono::steady_clock::now() - now);
                 }
-            };
+                continue;
+            }
 
-            std::ifstream in(db_path);
-            std::ostringstream csv;
-            csv << "id,hostname,os,cpu_cores,ram_mb,ip,timestamp\n";
-            std::string line;
-            while (std::getline(in, line)) {
-                if (line.empty()) continue;
-                csv << pick(line, "id") << ","
-                    << pick(line, "hostname") << ","
-                    << pick(line, "os") << ","
-                    << pick(line, "cpu_cores") << ","
-                    << pick(line, "ram_mb") << ","
-                    << pick(line, "ip") << ","
-                    << pick(line, "timestamp") << "\n";
+            if (fd == w.wake_fd) {
+                uint64_t cnt;
+                while (::read(w.wake_fd, &cnt, sizeof(cnt)) > 0) {}
+                {
+                    std::lock_guard<std::mutex> lk(w.done_mu);
+                    ready.swap(w.done);
+                }
+                for (auto& d : ready) {
+                    auto it = w.conns.find(d.fd);
+                    if (it == w.conns.end() || it->second.id != d.id) continue; // client went away meanwhile
+                    ReactorConn& c = it->second;
+                    reactor_settle(c, d.seq, std::move(d.resp));
+                    c.last_active = now;
+                    reactor_pump(w, d.fd, c, req);
+                }
+                ready.clear();
+                continue;
             }
 
-            std::string resp = http_response(200, "text/csv; charset=utf-8", csv.str());
-            send_all(cfd, resp);
-            close_socket(cfd);
-            continue;
+            auto it = w.conns.find(fd);
+            if (it == w.conns.end()) continue;
+            ReactorConn& c = it->second;
+            c.last_active = now;
+
+            if (evs & EPOLLERR) { reactor_close(w, fd); continue; }
+
+            // The handshake runs here, one step per readiness event, like any other I/O.
+            bool readable = evs & (EPOLLIN | EPOLLRDHUP | EPOLLHUP);
+            if (c.handshaking) {
+                bool want_write = false;
+                const int hs = tls_handshake(c.tls, &want_write);
+                if (hs == 0) { reactor_watch(w.ep, fd, c, want_write); continue; }
+                note_handshake(c.tls, hs == 1);
+                if (hs < 0) { reactor_close(w, fd); continue; }
+                c.handshaking = false;
+                reactor_watch(w.ep, fd, c, false);
+                readable = true; // the first request may already be waiting
+            }
+
+            if (readable && !c.read_paused) reactor_read(ctx.admission, w.ep, fd, c, now);
+            reactor_pump(w, fd, c, req);
         }
 
-        if (method == "POST" && path == "/api/assets") {
-            std::string why;
-            if (!json_has_required_keys(body, &why)) {
-                std::string resp = http_response(400, "application/json; charset=utf-8", std::string("{\"error\":\"") + json_escape(why) + "\"}");
-                send_all(cfd, resp);
-                close_socket(cfd);
-                continue;
+        if (now - last_sweep >= std::chrono::seconds(1)) {
+            last_sweep = now;
+            std::vector<int> idle, overdue;
+            for (auto& kv : w.conns) {
+                const ReactorConn& c = kv.second;
+                if (!c.pending.empty()) continue;
+                // A paused connection waits on its client to read; only the idle limit applies.
+                if (!c.unparsed().empty() && !c.close_after && !c.read_paused && request_overdue(ctx.admission, c.unparsed(), c.req_start, now)) {
+                    overdue.push_back(kv.first);
+                }
+                else if (now - c.last_active > idle_limit || (c.handshaking && now - c.req_start > handshake_limit)) idle.push_back(kv.first);
             }
+            for (int fd : idle) reactor_close(w, fd);
+            for (int fd : overdue) {
+                ReactorConn& c = w.conns[fd];
+                reactor_refuse(c, timeout_refusal());
+                reactor_pump(w, fd, c, req);
+            }
+        }
+    }
+    close(w.wake_fd);
+    close(w.ep);
+}
+#endif
 
-            { std::ofstream out(db_path, std::ios::app); out << body << "\n"; }
+static void server_loop(ServerContext& ctx, int port) {
+#if defined(_WIN32)
+    if (!winsock_init()) {
+        log_err("WSAStartup failed.");
+        return;
+    }
+#else
+    signal(SIGPIPE, SIG_IGN);
+#endif
 
-            std::string resp = http_response(201, "application/json; charset=utf-8", "{\"ok\":true}");
-            send_all(cfd, resp);
-            close_socket(cfd);
-            continue;
+    ctx.html = R"HTML(
+<!doctype html>
+<html>
+<head>
+  <meta charset="utf-8" />
+  <title>Asset Inventory Dashboard</title>
+  <style>
+    body{font-family:system-ui,Segoe UI,Arial;margin:24px}
+    h1{margin:0 0 12px}
+    table{border-collapse:collapse;width:100%}
+    th,td{border:1px solid #ddd;padding:10px;font-size:14px}
+    th{background:#f3f4f6;text-align:left}
+    .muted{color:#6b7280}
+    .row{display:flex;gap:12px;align-items:center;margin:12px 0}
+    a.btn{padding:8px 12px;border:1px solid #ddd;border-radius:10px;text-decoration:none}
+  </style>
+</head>
+<body>
+  <h1>Asset Inventory Dashboard</h1>
+  <div class="row">
+    <span class="muted">Refresh: otomatis (hanya baris yang berubah)</span>
+    <a class="btn" href="/api/export.csv">Export CSV</a>
+  </div>
+  <table>
+    <thead>
+      <tr><th>ID</th><th>Hostname</th><th>OS</th><th>Cores</th><th>RAM (MB)</th><th>IP</th><th>Timestamp</th></tr>
+    </thead>
+    <tbody id="tb"></tbody>
+  </table>
+
+<script>
+// Long-polls /api/assets?since_seq=N and patches only the rows that changed. Rows are keyed by
+// store slot; new slots always sort after the known ones, so they are simply appended.
+const tb = document.getElementById('tb');
+const rows = new Map();
+let seq = 0;
+function render(tr, it){
+  tr.innerHTML = `<td>${it.id||''}</td><td>${it.hostname||''}</td><td>${it.os||''}</td><td>${it.cpu_cores||''}</td><td>${it.ram_mb||''}</td><td>${it.ip||''}</td><td>${it.timestamp||''}</td>`;
+}
+async function poll(){
+  for (;;){
+    try {
+      const r = await fetch('/api/assets?since_seq=' + seq + '&wait=25');
+      const d = await r.json();
+      if (d.reset){ tb.innerHTML=''; rows.clear(); }
+      for (const c of d.items){
+        let tr = rows.get(c.slot);
+        if (!tr){ tr = document.createElement('tr'); rows.set(c.slot, tr); tb.appendChild(tr); }
+        render(tr, c.asset);
+      }
+      seq = d.seq;
+    } catch (e) {
+      await new Promise(res => setTimeout(res, 3000));
+    }
+  }
+}
+poll();
+</script>
+</body>
+</html>
+)HTML";
+    // The page never changes, so it is compressed once, as hard as the encoder goes.
+    if (ctx.compression.level > 0) {
+        ctx.html_gzip = compress_body(ctx.html, kEncGzip, 9);
+        ctx.html_deflate = compress_body(ctx.html, kEncDeflate, 9);
+    }
+
+    const int threads = ctx.threads > 0 ? ctx.threads : 1;
+
+#if defined(__linux__)
+    // Preferred: one SO_REUSEPORT listener per worker so the kernel spreads accepts across loops.
+    // Fallback: a single listener shared by every loop (EPOLLEXCLUSIVE wakes one loop per connection).
+    std::vector<int> listeners;
+    for (int i = 0; i < threads; i++) {
+        int fd = open_listener(port, true, ctx.backlog);
+        if (fd < 0) break;
+        listeners.push_back(fd);
+    }
+    bool shared = false;
+    if ((int)listeners.size() != threads) {
+        for (int fd : listeners) close_socket(fd);
+        listeners.clear();
+        int fd = open_listener(port, false, ctx.backlog);
+        if (fd < 0) return;
+        listeners.assign((size_t)threads, fd);
+        shared = true;
+    }
+    for (int fd : listeners) set_nonblocking(fd, true);
+
+    log_info(std::string("Server listening on ") + (ctx.tls ? "https" : "http") + "://127.0.0.1:" + std::to_string(port) + "/");
+    log_info("DB file: " + ctx.db_path);
+    log_info("Workers: " + std::to_string(threads) + " epoll loop(s), " + (shared ? "shared listener" : "SO_REUSEPORT"));
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) pool.emplace_back(reactor_worker, std::ref(ctx), listeners[(size_t)i], shared);
+    reactor_worker(ctx, listeners[0], shared);
+    for (auto& t : pool) t.join();
+#else
+    int listen_fd = open_listener(port, false, ctx.backlog);
+    if (listen_fd < 0) {
+#if defined(_WIN32)
+        winsock_cleanup();
+#endif
+        return;
+    }
+
+    log_info(std::string("Server listening on ") + (ctx.tls ? "https" : "http") + "://127.0.0.1:" + std::to_string(port) + "/");
+    log_info("DB file: " + ctx.db_path);
+    log_info("Workers: " + std::to_string(threads) + " thread(s)");
+
+    // Portable fallback: the accept loop hands sockets to a fixed pool of blocking workers.
+    std::mutex q_mu;
+    std::condition_variable q_cv;
+    struct Accepted { int fd; std::string peer; std::chrono::steady_clock::time_point at; };
+    std::deque<Accepted> q;
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) {
+        pool.emplace_back([&]() {
+            for (;;) {
+                int cfd;
+                std::string peer;
+                {
+                    std::unique_lock<std::mutex> lk(q_mu);
+                    q_cv.wait(lk, [&]{ return !q.empty(); });
+                    cfd = q.front().fd;
+                    peer = std::move(q.front().peer);
+                    Metrics::observe(kMetAcceptWait, std::chrono::steady_clock::now() - q.front().at);
+                    q.pop_front();
+                }
+                serve_blocking_connection(ctx, cfd, peer);
+            }
+        });
+    }
+
+    for (;;) {
+        sockaddr_in client{};
+#if defined(_WIN32)
+        int clen = sizeof(client);
+#else
+        socklen_t clen = sizeof(client);
+#endif
+        int cfd = (int)accept((SOCKET)listen_fd, (sockaddr*)&client, &clen);
+#if defined(_WIN32)
+        if (cfd == (int)INVALID_SOCKET) continue;
+#else
+        if (cfd < 0) continue;
+#endif
+        Metrics::add(kMetConnOpened);
+        {
+            std::lock_guard<std::mutex> lk(q_mu);
+            q.push_back(Accepted{cfd, sockaddr_ip((sockaddr*)&client), std::chrono::steady_clock::now()});
+        }
+        q_cv.notify_one();
+    }
+#endif
+}
+
+// ------------------------------
+// load generator (bench mode)
+// ------------------------------
+// Log-linear latency histogram in microseconds, HdrHistogram style: values below 64 are exact,
+// every power-of-two range above is split into 64 buckets (at most ~1.6% relative error).
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts_(kSub + (64 - kSubBits) * kSub, 0) {}
+
+    void record(uint64_t us) {
+        counts_[bucket(us)]++;
+        total_++;
+        sum_ += us;
+        if (us > max_) max_ = us;
+    }
+
+    void merge(const LatencyHistogram& o) {
+        for (size_t i = 0; i < counts_.size(); i++) counts_[i] += o.counts_[i];
+        total_ += o.total_;
+        sum_ += o.sum_;
+        if (o.max_ > max_) max_ = o.max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? (double)sum_ / (double)total_ : 0.0; }
+
+    // Highest value that falls in the same bucket as the q-quantile sample (0 < q <= 1).
+    uint64_t percentile(double q) const {
+        if (!total_) return 0;
+        uint64_t want = (uint64_t)std::ceil(q * (double)total_), seen = 0;
+        if (want == 0) want = 1;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= want) return std::min(bucket_top(i), max_);
+        }
+        return max_;
+    }
+
+private:
+    static const unsigned kSubBits = 6;
+    static const size_t kSub = (size_t)1 << kSubBits;
+
+    static size_t bucket(uint64_t v) {
+        if (v < kSub) return (size_t)v;
+        const unsigned shift = msb64(v) - kSubBits;
+        return kSub + shift * kSub + (size_t)((v >> shift) - kSub);
+    }
+
+    static uint64_t bucket_top(size_t i) {
+        if (i < kSub) return i;
+        const unsigned shift = (unsigned)((i - kSub) / kSub);
+        const uint64_t sub = (i - kSub) % kSub;
+        return ((kSub + sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0, sum_ = 0, max_ = 0;
+};
+
+struct BenchOptions {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int concurrency = 64;      // connections, one thread each
+    int duration_s = 10;
+    double rate = 0;           // total requests per second; 0 = as fast as the server answers
+    size_t payload_bytes = 0;  // POST bodies are padded up to roughly this size
+    int agents = 10000;        // distinct simulated agents (ids/hostnames) to draw from
+    int read_pct = 0;          // share of requests that are GETs of read_path
+    std::string read_path = "/api/assets?limit=100";
+    int timeout_ms = 5000;
+    const TlsContext* tls = nullptr; // HTTPS when set
+    bool new_conn = false;           // a fresh connection per request, like a fleet of one-shot agents
+};
+
+struct BenchResult {
+    LatencyHistogram post, get;
+    uint64_t post_errors = 0, get_errors = 0;
+    uint64_t tls_handshakes = 0, tls_resumed = 0;
+};
+
+static std::string bench_payload(std::mt19937_64& rng, const BenchOptions& o) {
+    static const char* const kOs[] = {"Linux", "Windows", "macOS", "FreeBSD"};
+    const unsigned agent = (unsigned)(rng() % (uint64_t)o.agents);
+    const long long now = (long long)std::chrono::duration_cast<std::chrono::seconds>(
+                              std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::string out;
+    out.reserve(std::max<size_t>(256, o.payload_bytes + 16));
+    out += "{\"id\":\"bench-"; out += std::to_string(agent);
+    out += "\",\"hostname\":\"bench-host-"; out += std::to_string(agent);
+    out += "\",\"os\":\""; out += kOs[agent % 4];
+    out += "\",\"cpu_cores\":"; out += std::to_string(1 + rng() % 64);
+    out += ",\"ram_mb\":"; out += std::to_string(1024 * (1 + rng() % 128));
+    out += ",\"ip\":\"10."; out += std::to_string((agent >> 16) & 255); out += '.';
+    out += std::to_string((agent >> 8) & 255); out += '.'; out += std::to_string(agent & 255);
+    out += "\",\"timestamp\":\""; out += format_iso8601(now, kTzZulu); out += '"';
+    const size_t pad_overhead = sizeof(",\"notes\":\"\"}") - 1;
+    if (o.payload_bytes > out.size() + pad_overhead) {
+        out += ",\"notes\":\"";
+        out.append(o.payload_bytes - out.size() - 2, 'x');
+        out += '"';
+    }
+    out += '}';
+    return out;
+}
+
+// One closed-loop connection. With a rate, sends follow a fixed schedule and latency is taken
+// from the scheduled send time, so a stalled server shows up in the tail instead of being hidden
+// by the client waiting (coordinated omission).
+static void bench_connection(const BenchOptions& o, int index, std::chrono::steady_clock::time_point until, BenchResult& res) {
+    using clock = std::chrono::steady_clock;
+    std::mt19937_64 rng(0x9e3779b97f4a7c15ULL * (uint64_t)(index + 1));
+    HttpClient client(o.host, o.port, o.timeout_ms, o.tls);
+    const auto interval = o.rate > 0
+        ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((double)o.concurrency / o.rate))
+        : clock::duration::zero();
+    // Stagger the schedules so the connections do not fire in lockstep.
+    auto next = clock::now() + interval * index / std::max(1, o.concurrency);
+
+    std::string body;
+    while (clock::now() < until) {
+        if (o.rate > 0) {
+            if (next >= until) break;
+            std::this_thread::sleep_until(next);
+        }
+        const auto start = o.rate > 0 ? next : clock::now();
+        next += interval;
+
+        const bool read = o.read_pct > 0 && (int)(rng() % 100) < o.read_pct;
+        const int code = read ? client.request("GET", o.read_path, "", &body)
+                              : client.request("POST", "/api/assets", bench_payload(rng, o));
+        const uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+        const bool ok = code >= 200 && code < 300;
+        if (read) { res.get.record(us); if (!ok) res.get_errors++; }
+        else { res.post.record(us); if (!ok) res.post_errors++; }
+        if (o.new_conn) client.disconnect();
+    }
+    res.tls_handshakes = client.tls_handshakes();
+    res.tls_resumed = client.tls_resumptions();
+}
+
+static void print_bench_line(const char* what, const LatencyHistogram& h, uint64_t errors, double secs) {
+    if (!h.count()) return;
+    std::printf("%-28s requests=%llu errors=%llu throughput=%.1f req/s\n", what,
+                (unsigned long long)h.count(), (unsigned long long)errors, (double)h.count() / secs);
+    std::printf("  latency (us): p50=%llu p90=%llu p99=%llu p999=%llu max=%llu mean=%.1f\n",
+                (unsigned long long)h.percentile(0.50), (unsigned long long)h.percentile(0.90),
+                (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999),
+                (unsigned long long)h.max(), h.mean());
+}
+
+// The server's asset_heap_allocations_total, or -1 when it does not export one.
+static long long bench_server_allocs(const BenchOptions& o) {
+    HttpClient client(o.host, o.port, o.timeout_ms, o.tls);
+    std::string body;
+    if (client.request("GET", "/metrics", "", &body) != 200) return -1;
+    const std::string name = "\nasset_heap_allocations_total ";
+    const size_t at = body.find(name);
+    return at == std::string::npos ? -1 : std::atoll(body.c_str() + at + name.size());
+}
+
+// Returns 0 when every request got a 2xx answer.
+static int run_bench(const BenchOptions& o) {
+    log_info("Bench: " + std::to_string(o.concurrency) + " connection(s) to " + (o.tls ? "https://" : "http://") + o.host + ":" + std::to_string(o.port) +
+             " for " + std::to_string(o.duration_s) + "s, rate " + (o.rate > 0 ? std::to_string((long long)o.rate) + "/s" : std::string("unlimited")) +
+             ", " + std::to_string(o.agents) + " agent(s), " + std::to_string(o.read_pct) + "% reads");
+
+    const long long allocs0 = bench_server_allocs(o);
+    std::vector<BenchResult> results((size_t)o.concurrency);
+    std::vector<std::thread> threads;
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto until = t0 + std::chrono::seconds(o.duration_s);
+    for (int i = 0; i < o.concurrency; i++) {
+        threads.emplace_back([&o, i, until, &results] { bench_connection(o, i, until, results[(size_t)i]); });
+    }
+    for (auto& t : threads) t.join();
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    const long long allocs1 = allocs0 < 0 ? -1 : bench_server_allocs(o);
+
+    BenchResult total;
+    for (const auto& r : results) {
+        total.post.merge(r.post);
+        total.get.merge(r.get);
+        total.post_errors += r.post_errors;
+        total.get_errors += r.get_errors;
+        total.tls_handshakes += r.tls_handshakes;
+        total.tls_resumed += r.tls_resumed;
+    }
+    log_flush();
+    print_bench_line("POST /api/assets", total.post, total.post_errors, secs);
+    print_bench_line(("GET " + o.read_path).c_str(), total.get, total.get_errors, secs);
+    const uint64_t all = total.post.count() + total.get.count();
+    std::printf("%-28s requests=%llu throughput=%.1f req/s over %.2fs\n", "total",
+                (unsigned long long)all, (double)all / secs, secs);
+    if (allocs1 >= allocs0 && allocs0 >= 0 && all > 0) {
+        std::printf("%-28s %lld during the run, %.1f per request\n", "server heap allocations",
+                    allocs1 - allocs0, (double)(allocs1 - allocs0) / (double)all);
+    }
+    if (o.tls) {
+        std::printf("%-28s %llu, %llu resumed\n", "tls handshakes",
+                    (unsigned long long)total.tls_handshakes, (unsigned long long)total.tls_resumed);
+    }
+    std::fflush(stdout);
+    return all > 0 && total.post_errors + total.get_errors == 0 ? 0 : 1;
+}
+
+// ------------------------------
+// agent daemon (scheduled reports, on-disk spool)
+// ------------------------------
+// "300", "300s", "5m", "1h" or "1500ms"; a bare number is seconds.
+static bool parse_duration_ms(const std::string& s, long long* ms) {
+    size_t digits = 0;
+    while (digits < s.size() && s[digits] >= '0' && s[digits] <= '9') digits++;
+    unsigned long long n;
+    if (!parse_uint(s.substr(0, digits), 1ull << 40, &n)) return false;
+    const std::string unit = s.substr(digits);
+    const long long scale = unit == "ms" ? 1 : unit.empty() || unit == "s" ? 1000 : unit == "m" ? 60000 : unit == "h" ? 3600000 : 0;
+    if (!scale) return false;
+    *ms = (long long)n * scale;
+    return true;
+}
+
+// The newest report not delivered yet, mirrored to a file so it survives restarts. Each report
+// replaces the one before it on the server, so an older undelivered one is never worth sending:
+// a new report simply takes its place.
+class AgentSpool {
+public:
+    explicit AgentSpool(std::string path) : path_(std::move(path)) {}
+
+    // A spool left by an older agent may hold several reports, oldest first; the newest is kept.
+    void load() {
+        std::ifstream in(path_);
+        std::string line;
+        size_t lines = 0;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) { rec_ = line; lines++; }
         }
+        if (lines > 1) rewrite();
+    }
+
+    bool empty() const { return rec_.empty(); }
+    const std::string& record() const { return rec_; }
+
+    void put(const std::string& rec) {
+        rec_ = rec;
+        rewrite();
+    }
+
+    void clear() {
+        rec_.clear();
+        rewrite();
+    }
+
+private:
+    // Written next to the spool and renamed over it, so a crash leaves the old or the new file.
+    void rewrite() {
+        const std::string tmp = path_ + ".tmp";
+        std::FILE* f = std::fopen(tmp.c_str(), "wb");
+        if (!f) { log_warn("Cannot write spool " + tmp); return; }
+        bool ok = rec_.empty() || (std::fwrite(rec_.data(), 1, rec_.size(), f) == rec_.size() && std::fputc('\n', f) != EOF);
+        ok = sync_file(f) && ok;
+        std::fclose(f);
+        std::error_code ec;
+        if (ok) std::filesystem::rename(tmp, path_, ec);
+        if (!ok || ec) log_warn("Cannot rewrite spool " + path_);
+    }
+
+    std::string path_;
+    std::string rec_;
+};
+
+// The last full record the server acknowledged, so reports can be sent as changes against it
+// across agent restarts. Empty when there is none.
+static std::string load_agent_state(const std::string& path) {
+    std::ifstream in(path);
+    std::string rec;
+    std::getline(in, rec);
+    if (!rec.empty() && rec.back() == '\r') rec.pop_back();
+    return rec;
+}
+
+static void save_agent_state(const std::string& path, const std::string& rec) {
+    const std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) { log_warn("Cannot write agent state " + tmp); return; }
+    bool ok = std::fwrite(rec.data(), 1, rec.size(), f) == rec.size() && std::fputc('\n', f) != EOF;
+    ok = sync_file(f) && ok;
+    std::fclose(f);
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmp, path, ec);
+    if (!ok || ec) log_warn("Cannot write agent state " + path);
+}
+
+// What to send for `rec` when the server holds `acked` (see "record changes"): a heartbeat when
+// only the timestamp moved, a delta of the changed fields otherwise, or `rec` itself when the
+// ids differ or the delta would not be any smaller.
+static std::string encode_record_change(const std::string& acked, const std::string& rec) {
+    std::vector<std::pair<std::string_view, std::string_view>> a, r;
+    if (!json_object_fields(acked, a) || !json_object_fields(rec, r)) return rec;
+    auto get = [](const auto& fields, std::string_view key) {
+        for (const auto& f : fields) if (f.first == key) return f.second;
+        return std::string_view();
+    };
+    const std::string_view id = get(a, "id"), hostname = get(a, "hostname"), timestamp = get(r, "timestamp");
+    if (id.empty() || hostname.empty() || timestamp.empty() || get(r, "id") != id) return rec;
+
+    std::string set, unset;
+    for (const auto& f : r) {
+        if (f.first == "id" || f.first == "timestamp" || get(a, f.first) == f.second) continue;
+        set += set.empty() ? "{\"" : ",\"";
+        set += f.first; set += "\":"; set += f.second;
+    }
+    for (const auto& f : a) {
+        if (f.first == "id" || f.first == "timestamp" || !get(r, f.first).empty()) continue;
+        unset += unset.empty() ? "[\"" : ",\"";
+        unset += f.first; unset += '"';
+    }
+    const bool heartbeat = set.empty() && unset.empty();
+    std::string out = heartbeat ? "{\"op\":\"heartbeat\"" : "{\"op\":\"delta\"";
+    out += ",\"id\":"; out += id;
+    out += ",\"hostname\":"; out += hostname;
+    out += ",\"timestamp\":"; out += timestamp;
+    if (!heartbeat) { out += ",\"base\":\""; out += record_hash(acked); out += '"'; }
+    out += ",\"hash\":\""; out += record_hash(rec); out += '"';
+    if (!set.empty()) { out += ",\"set\":"; out += set; out += '}'; }
+    if (!unset.empty()) { out += ",\"unset\":"; out += unset; out += ']'; }
+    out += '}';
+    return out.size() < rec.size() ? out : rec;
+}
+
+struct AgentOptions {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string path = "/api/assets";
+    int timeout_ms = 2000;
+    std::string id, ip;
+    long long interval_ms = 300000;
+    double jitter = 0.1;            // each wait is interval * (1 +/- jitter)
+    long long max_backoff_ms = 300000;
+    std::string spool_path = "data/agent_spool.jsonl";
+    std::string state_path = "data/agent_state.json";
+    int probe_timeout_ms = 2000;
+    std::string skip_probes;
+    const TlsContext* tls = nullptr; // HTTPS when set
+};
+
+static volatile std::sig_atomic_t g_agent_stop = 0;
+static void agent_on_signal(int) { g_agent_stop = 1; }
+
+// Sends the spooled report as a change against `acked`, and moves `acked` along. Returns false
+// when the server could not be reached or failed the report, which stays spooled.
+static bool agent_drain(HttpClient& client, const AgentOptions& o, AgentSpool& spool, std::string& acked) {
+    if (spool.empty()) return true;
+    const std::string acked_before = acked;
+    const std::string rec = spool.record();
+    const std::string send = acked.empty() ? rec : encode_record_change(acked, rec);
+    int code = client.request("POST", o.path, send);
+    if (code == 409 && send != rec) {
+        // The server no longer holds what we last sent (lost, replaced, or another agent with
+        // this id): start over from a full record.
+        log_info("Server does not have the acknowledged record; resending in full");
+        acked.clear();
+        code = client.request("POST", o.path, rec);
+    }
+    if (code == 200 || code == 201) {
+        acked = rec;
+        spool.clear();
+        log_info("Report delivered");
+    } else if (code == 400) { // will never be accepted
+        spool.clear();
+        log_warn("Server refused the spooled report; dropped");
+    } else if (code > 0) {
+        log_warn("Server response HTTP " + std::to_string(code));
+    }
+    if (acked != acked_before) save_agent_state(o.state_path, acked);
+    return spool.empty();
+}
+
+// Collects and reports every interval until SIGINT/SIGTERM. Reports go through the spool, so
+// one the server does not take now is retried with capped exponential backoff, until a newer
+// report replaces it, and survives an agent restart.
+static int run_agent_daemon(const AgentOptions& o) {
+    std::error_code ec;
+    const std::filesystem::path spool_dir = std::filesystem::path(o.spool_path).parent_path();
+    if (!spool_dir.empty()) std::filesystem::create_directories(spool_dir, ec);
+    AgentSpool spool(o.spool_path);
+    spool.load();
+    if (!spool.empty()) log_info("Spool holds a report from an earlier run");
+    std::string acked = load_agent_state(o.state_path);
+
+    signal(SIGINT, agent_on_signal);
+    signal(SIGTERM, agent_on_signal);
+
+    std::mt19937_64 rng(std::random_device{}() ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count());
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    auto jittered = [&](long long ms, double spread) {
+        return std::chrono::milliseconds((long long)((double)ms * (1.0 + spread * (2 * unit(rng) - 1))));
+    };
+
+    HttpClient client(o.host, o.port, o.timeout_ms, o.tls);
+    CollectorRegistry probes; // lives as long as the daemon, so TTL-cached results carry over
+    register_agent_probes(probes, o.ip, o.host, o.port, std::chrono::milliseconds(o.probe_timeout_ms));
+    skip_agent_probes(probes, o.skip_probes);
+    log_info(std::string("Agent daemon reporting to ") + (o.tls ? "https://" : "http://") + o.host + ":" + std::to_string(o.port) + o.path + " every " +
+             std::to_string(o.interval_ms / 1000) + "s (id " + o.id + ", spool " + o.spool_path + ")");
 
-        std::string resp = http_response(404, "application/json; charset=utf-8", "{\"error\":\"not found\"}");
-        send_all(cfd, resp);
-        close_socket(cfd);
+    using clock = std::chrono::steady_clock;
+    // The first report also waits a random share of the jitter so restarted fleets spread out.
+    clock::time_point next_report = clock::now() + std::chrono::milliseconds((long long)((double)o.interval_ms * o.jitter * unit(rng)));
+    clock::time_point next_retry = clock::time_point::max();
+    int failures = 0;
+    while (!g_agent_stop) {
+        const clock::time_point now = clock::now();
+        const clock::time_point wake = std::min(next_report, next_retry);
+        if (now < wake) {
+            std::this_thread::sleep_for(std::min<clock::duration>(wake - now, std::chrono::milliseconds(200)));
+            continue;
+        }
+        if (now >= next_report) {
+            if (!spool.empty()) log_info("Replacing the undelivered report with a new one");
+            spool.put(build_asset_json(probes, o.id));
+            next_report = now + jittered(o.interval_ms, o.jitter);
+        }
+        if (agent_drain(client, o, spool, acked)) {
+            failures = 0;
+            next_retry = clock::time_point::max();
+            continue;
+        }
+        // Backoff doubles from 1s up to the cap; each wait is drawn from its upper half.
+        failures++;
+        const long long cap = std::min(o.max_backoff_ms, 1000ll << std::min(failures - 1, 20));
+        const auto wait = std::chrono::milliseconds(cap / 2 + (long long)((double)(cap / 2) * unit(rng)));
+        next_retry = clock::now() + wait;
+        log_warn("Report spooled, retry in " + std::to_string((long long)wait.count()) + "ms (attempt " + std::to_string(failures) + ")");
     }
+    log_info(spool.empty() ? "Agent daemon stopping" : "Agent daemon stopping; the undelivered report stays in the spool");
+    return 0;
 }
 
 static void print_help() {
+    log_flush(); // whatever was logged before (a usage error) comes first
     std::cout <<
 R"HELP(
 Asset Inventory (C++17) - single binary
 
 USAGE:
-  asset_inventory server --port 8080 [--db data/assets.jsonl]
+  asset_inventory server --port 8080 [--db data/assets.jsonl] [--threads <n>] [--idle-timeout 30000]
+                         [--index-key id|hostname] [--batch-ms 2] [--batch-max 1024] [--fsync batch|off]
+                         [--db-format jsonl|columnar] [--compact-mb 64] [--gzip-level 6] [--gzip-min-bytes 1024]
+                         [--cache-mb 64] [--backlog <n>] [--max-header-kb 64] [--max-body-mb 16] [--header-timeout 10000]
+                         [--body-timeout 60000] [--max-inflight 4096] [--max-queue 65536] [--rate-ip 0] [--rate-agent 10:20]
+                         [--access-log-sample 0] [--load-threads <n>] [--tls-cert <pem> --tls-key <pem> [--tls-client-ca <pem>]]
+  asset_inventory convert --from <db> --to <db> [--to-format columnar|jsonl]
   asset_inventory agent  --host 127.0.0.1 --port 8080 --path /api/assets [--retries 3] [--timeout 2000] [--id <id>] [--ip <ip>]
+                         [--from-file <records.jsonl> [--batch <n>]] [--probe-timeout 2000] [--skip-probes packages,disks]
+                         [--state <file>] [--tls] [--tls-ca <pem>] [--tls-cert <pem> --tls-key <pem>]
+                         [--daemon [--interval 300s] [--jitter 0.1] [--max-backoff 300s] [--spool data/agent_spool.jsonl]
+                                   [--state data/agent_state.json]]
+  asset_inventory compress [--encoding gzip|deflate] [--level 6] [--chunk <n>]   (stdin -> stdout)
+  asset_inventory bench  --host 127.0.0.1 --port 8080 [--concurrency 64] [--duration 10] [--rate <req/s>]
+                         [--payload-bytes <n>] [--agents 10000] [--read-pct 0] [--read-path /api/assets?limit=100]
+                         [--new-conn] [--tls] [--tls-ca <pem>] [--tls-cert <pem> --tls-key <pem>]
+
+  Every mode: [--log-level debug|info|warn|error] [--log-format text|json]
 
 EXAMPLES:
   ./bin/asset_inventory server --port 8080
   ./bin/asset_inventory agent --host 127.0.0.1 --port 8080 --path /api/assets --retries 3 --timeout 2000
+  ./bin/asset_inventory agent --host 127.0.0.1 --port 8080 --daemon --interval 5m
+  ./bin/asset_inventory convert --from data/assets.jsonl --to data/assets.col --to-format columnar
+  ./bin/asset_inventory bench --port 8080 --concurrency 256 --duration 30 --rate 20000 --read-pct 10
+  ./bin/asset_inventory server --port 8443 --tls-cert server.crt --tls-key server.key --tls-client-ca ca.crt   (make TLS=1)
+  ./bin/asset_inventory agent --port 8443 --tls-ca ca.crt --tls-cert agent.crt --tls-key agent.key
 )HELP";
 }
 
@@ -619,6 +6730,25 @@ static std::string arg_value(const std::vector<std::string>& args, const std::st
     return def;
 }
 
+static bool has_flag(const std::vector<std::string>& args, const std::string& key) {
+    return std::find(args.begin(), args.end(), key) != args.end();
+}
+
+// Client side of --tls [--tls-ca <pem>] [--tls-cert <pem> --tls-key <pem>]: any of them turns
+// HTTPS on. Returns false (logged) when the context cannot be built; *tls stays null for HTTP.
+static bool client_tls(const std::vector<std::string>& args, std::unique_ptr<TlsContext>* tls) {
+    TlsOptions o;
+    o.ca = arg_value(args, "--tls-ca", "");
+    o.cert = arg_value(args, "--tls-cert", "");
+    o.key = arg_value(args, "--tls-key", "");
+    if (!has_flag(args, "--tls") && o.ca.empty() && o.cert.empty()) return true;
+    std::unique_ptr<TlsContext> ctx(new TlsContext());
+    std::string why;
+    if (!ctx->init_client(o, &why)) { log_err("TLS: " + why); return false; }
+    *tls = std::move(ctx);
+    return true;
+}
+
 int main(int argc, char** argv) {
 #if defined(_WIN32)
     winsock_init();
@@ -633,14 +6763,33 @@ int main(int argc, char** argv) {
     for (int i = 1; i < argc; i++) args.emplace_back(argv[i]);
     const std::string mode = args[0];
 
+    // Logging options apply to every mode.
+    static const char* const kLevels[] = {"debug", "info", "warn", "error"};
+    const std::string level = arg_value(args, "--log-level", "info");
+    const auto lv = std::find(std::begin(kLevels), std::end(kLevels), level);
+    const std::string log_format = arg_value(args, "--log-format", "text");
+    if (lv == std::end(kLevels) || (log_format != "text" && log_format != "json")) {
+        log_err("--log-level must be debug|info|warn|error and --log-format text|json");
+        return 2;
+    }
+    Logger::get().set_level((LogLevel)(lv - std::begin(kLevels)));
+    Logger::get().set_json(log_format == "json");
+
     if (mode == "--help" || mode == "-h" || mode == "help") {
         print_help();
         return 0;
     }
 
     if (mode == "server") {
+        const auto started = std::chrono::steady_clock::now();
         int port = std::atoi(arg_value(args, "--port", "8080").c_str());
-        std::string db = arg_value(args, "--db", "data/assets.jsonl");
+        const std::string db_format = arg_value(args, "--db-format", "jsonl");
+        if (db_format != "jsonl" && db_format != "columnar") {
+            log_err("Unknown --db-format: " + db_format);
+            return 2;
+        }
+        const bool columnar = db_format == "columnar";
+        std::string db = arg_value(args, "--db", columnar ? "data/assets.col" : "data/assets.jsonl");
 
         // Create db dir best-effort
         auto slash = db.find_last_of("/\\");
@@ -653,18 +6802,229 @@ int main(int argc, char** argv) {
 #endif
         }
 
-        server_loop(port, db);
+        ServerContext ctx;
+        ctx.db_path = db;
+        ctx.store.set_key_by_hostname(arg_value(args, "--index-key", "id") == "hostname");
+        const unsigned load_threads = (unsigned)std::max(1, std::atoi(arg_value(args, "--load-threads", std::to_string(get_cpu_cores() ? get_cpu_cores() : 1)).c_str()));
+        ctx.storage.batch_window_ms = std::atoi(arg_value(args, "--batch-ms", "2").c_str());
+        ctx.storage.batch_max = (size_t)std::max(1, std::atoi(arg_value(args, "--batch-max", "1024").c_str()));
+        ctx.storage.fsync = arg_value(args, "--fsync", "batch") != "off";
+        ctx.storage.compact_bytes = (uint64_t)std::max(0, std::atoi(arg_value(args, "--compact-mb", "64").c_str())) << 20;
+        std::unique_ptr<StorageBackend> backend;
+        if (columnar) backend.reset(new ColumnarBackend());
+        else backend.reset(new JsonlBackend());
+        if (!backend->open(db)) return 1;
+        ctx.idle_timeout_ms = std::atoi(arg_value(args, "--idle-timeout", "30000").c_str());
+        ctx.compression.level = std::min(9, std::max(0, std::atoi(arg_value(args, "--gzip-level", "6").c_str())));
+        ctx.compression.min_bytes = (size_t)std::max(0, std::atoi(arg_value(args, "--gzip-min-bytes", "1024").c_str()));
+        ctx.cache.set_budget((size_t)std::max(0, std::atoi(arg_value(args, "--cache-mb", "64").c_str())) << 20);
+        ctx.access_log_sample = std::min(1.0, std::max(0.0, std::atof(arg_value(args, "--access-log-sample", "0").c_str())));
+        ctx.backlog = std::max(1, std::atoi(arg_value(args, "--backlog", std::to_string(SOMAXCONN)).c_str()));
+        AdmissionOptions& adm = ctx.admission;
+        adm.max_header_bytes = (size_t)std::max(1, std::atoi(arg_value(args, "--max-header-kb", "64").c_str())) << 10;
+        adm.max_body_bytes = (size_t)std::max(1, std::atoi(arg_value(args, "--max-body-mb", "16").c_str())) << 20;
+        adm.header_timeout_ms = std::max(1, std::atoi(arg_value(args, "--header-timeout", "10000").c_str()));
+        adm.body_timeout_ms = std::max(adm.header_timeout_ms, std::atoi(arg_value(args, "--body-timeout", "60000").c_str()));
+        adm.max_inflight = (size_t)std::max(1, std::atoi(arg_value(args, "--max-inflight", "4096").c_str()));
+        adm.max_queue = (size_t)std::max(1, std::atoi(arg_value(args, "--max-queue", "65536").c_str()));
+        double rate, burst;
+        if (!parse_rate_limit(arg_value(args, "--rate-ip", "0"), &rate, &burst)) { log_err("--rate-ip must look like 50 or 50:200"); return 2; }
+        ctx.rate_ip.configure(rate, burst);
+        if (!parse_rate_limit(arg_value(args, "--rate-agent", "10:20"), &rate, &burst)) { log_err("--rate-agent must look like 10 or 10:20"); return 2; }
+        ctx.rate_agent.configure(rate, burst);
+        ctx.threads = std::atoi(arg_value(args, "--threads", std::to_string(get_cpu_cores() ? get_cpu_cores() : 1)).c_str());
+        TlsOptions tls;
+        tls.cert = arg_value(args, "--tls-cert", "");
+        tls.key = arg_value(args, "--tls-key", "");
+        tls.ca = arg_value(args, "--tls-client-ca", "");
+        if (!tls.cert.empty() || !tls.key.empty() || !tls.ca.empty()) {
+            std::string why;
+            ctx.tls.reset(new TlsContext());
+            if (tls.cert.empty() || !ctx.tls->init_server(tls, &why)) {
+                log_err("TLS: " + (why.empty() ? std::string("--tls-cert is required") : why));
+                return 2;
+            }
+            if (ctx.tls->mutual()) log_info("TLS: client certificates signed by " + tls.ca + " required");
+        }
+
+        // The DB loads while the server already listens (answering 503 until ready); the writer
+        // and its followers start only once the store holds everything on disk.
+        std::thread loader([&ctx, &db, columnar, load_threads, started, backend = std::move(backend)]() mutable {
+            auto t0 = std::chrono::steady_clock::now();
+            size_t bad = 0;
+            size_t lines = columnar ? load_columnar(ctx.store, db, &bad, &ctx.load)
+                                    : load_jsonl_db(ctx.store, db, &bad, load_threads, &ctx.load);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+            log_info("Loaded " + std::to_string(lines) + " line(s) -> " + std::to_string(ctx.store.size()) + " asset(s) in " +
+                     std::to_string((long long)ms) + "ms" + (columnar ? std::string() : " on " + std::to_string(load_threads) + " thread(s)"));
+            if (bad) log_warn("Skipped " + std::to_string(bad) + " invalid line(s) in " + db);
+            ctx.feed.start(ctx.store.seq());
+            ctx.writer.set_on_applied([&ctx] {
+                ctx.cache.clear();
+                ctx.feed.notify(ctx.store.seq());
+            });
+            if (!columnar && ctx.storage.compact_bytes) {
+                ctx.compactor.start(db, &ctx.store);
+                ctx.writer.set_compactor(&ctx.compactor);
+            }
+            ctx.writer.start(std::move(backend), ctx.storage, &ctx.store);
+            const auto ready = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+            ctx.load.ready_ms = (uint64_t)ready;
+            ctx.load.ready.store(true, std::memory_order_release);
+            log_info("Ready in " + std::to_string((long long)ready) + "ms since start");
+        });
+        server_loop(ctx, port);
+        loader.join();
         return 0;
     }
 
+    if (mode == "convert") {
+        const std::string from = arg_value(args, "--from", "");
+        const std::string to = arg_value(args, "--to", "");
+        if (from.empty() || to.empty()) {
+            print_help();
+            return 2;
+        }
+        return convert_db(from, to, arg_value(args, "--to-format", "columnar"));
+    }
+
+    if (mode == "compress") {
+        // stdin -> stdout through HttpCompressor, fed --chunk bytes at a time (0 = all at once);
+        // `make check-gzip` inflates the result with gzip/zlib to prove the encoder's output.
+        const std::string enc = arg_value(args, "--encoding", "gzip");
+        if (enc != "gzip" && enc != "deflate") {
+            log_err("--encoding must be gzip|deflate");
+            return 2;
+        }
+        const int level = std::min(9, std::max(1, std::atoi(arg_value(args, "--level", "6").c_str())));
+        const size_t chunk = (size_t)std::max(0, std::atoi(arg_value(args, "--chunk", "0").c_str()));
+#if defined(_WIN32)
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        std::string in, out;
+        char buf[65536];
+        for (size_t n; (n = std::fread(buf, 1, sizeof(buf), stdin)) > 0;) in.append(buf, n);
+        HttpCompressor z(enc == "gzip" ? kEncGzip : kEncDeflate, level);
+        size_t pos = 0;
+        do {
+            const size_t take = chunk ? std::min(chunk, in.size() - pos) : in.size() - pos;
+            z.write(std::string_view(in).substr(pos, take), pos + take == in.size(), out);
+            pos += take;
+        } while (pos < in.size());
+        return std::fwrite(out.data(), 1, out.size(), stdout) == out.size() && std::fflush(stdout) == 0 ? 0 : 1;
+    }
+
+    if (mode == "bench") {
+        BenchOptions o;
+        o.host = arg_value(args, "--host", o.host);
+        o.port = std::atoi(arg_value(args, "--port", "8080").c_str());
+        o.concurrency = std::max(1, std::atoi(arg_value(args, "--concurrency", "64").c_str()));
+        o.duration_s = std::max(1, std::atoi(arg_value(args, "--duration", "10").c_str()));
+        o.rate = std::atof(arg_value(args, "--rate", "0").c_str());
+        o.payload_bytes = (size_t)std::max(0, std::atoi(arg_value(args, "--payload-bytes", "0").c_str()));
+        o.agents = std::max(1, std::atoi(arg_value(args, "--agents", "10000").c_str()));
+        o.read_pct = std::min(100, std::max(0, std::atoi(arg_value(args, "--read-pct", "0").c_str())));
+        o.read_path = arg_value(args, "--read-path", o.read_path);
+        o.timeout_ms = std::atoi(arg_value(args, "--timeout", "5000").c_str());
+        o.new_conn = has_flag(args, "--new-conn");
+        std::unique_ptr<TlsContext> tls;
+        if (!client_tls(args, &tls)) return 2;
+        o.tls = tls.get();
+        return run_bench(o);
+    }
+
     if (mode == "agent") {
         const std::string host = arg_value(args, "--host", "127.0.0.1");
         const int port = std::atoi(arg_value(args, "--port", "8080").c_str());
         const std::string path = arg_value(args, "--path", "/api/assets");
         const int retries = std::atoi(arg_value(args, "--retries", "3").c_str());
         const int timeout_ms = std::atoi(arg_value(args, "--timeout", "2000").c_str());
+        std::unique_ptr<TlsContext> tls;
+        if (!client_tls(args, &tls)) return 2;
+        const std::string scheme = tls ? "https://" : "http://";
+        HttpClient client(host, port, timeout_ms, tls.get());
+
+        // Bulk/relay mode: forward every JSON line of a file over one pipelined keep-alive connection.
+        const std::string from_file = arg_value(args, "--from-file", "");
+        if (!from_file.empty()) {
+            std::ifstream in(from_file);
+            if (!in) { log_err("Cannot open " + from_file); return 2; }
+            std::vector<std::string> pending;
+            std::string line, why;
+            AssetView v;
+            while (std::getline(in, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                if (!parse_asset_json(line, v, &why)) { log_warn("Skipping invalid record: " + why); continue; }
+                pending.push_back(line);
+            }
+            log_info("Sending " + std::to_string(pending.size()) + " record(s) to " + scheme + host + ":" + std::to_string(port) + path);
+
+            // --batch <n>: n records per request to <path>/batch instead of one pipelined POST each.
+            const int batch = std::atoi(arg_value(args, "--batch", "0").c_str());
+            size_t sent_ok = 0;
+            for (int attempt = 0; !pending.empty(); ) {
+                std::vector<int> codes = batch > 0 ? client.post_batched(path + "/batch", pending, (size_t)batch)
+                                                   : client.post_pipelined(path, pending);
+                std::vector<std::string> failed;
+                for (size_t i = 0; i < codes.size(); i++) {
+                    if (codes[i] == 201 || codes[i] == 200) sent_ok++;
+                    else failed.push_back(std::move(pending[i]));
+                }
+                pending.swap(failed);
+                if (pending.empty()) break;
+
+                attempt++;
+                if (attempt > retries) break;
+                int backoff_ms = 500 * attempt;
+                log_info(std::to_string(pending.size()) + " record(s) failed, retry in " + std::to_string(backoff_ms) + "ms (" + std::to_string(attempt) + "/" + std::to_string(retries) + ")");
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+            }
+            log_info("Sent " + std::to_string(sent_ok) + " record(s), " + std::to_string(pending.size()) + " failed");
+            return pending.empty() ? 0 : 1;
+        }
+
+        const int probe_timeout_ms = std::max(1, std::atoi(arg_value(args, "--probe-timeout", "2000").c_str()));
+        const std::string skip_probes = arg_value(args, "--skip-probes", "");
+
+        // Long-lived reporter: the same id every time, so each report replaces the last one.
+        if (has_flag(args, "--daemon")) {
+            AgentOptions o;
+            o.host = host;
+            o.port = port;
+            o.path = path;
+            o.timeout_ms = timeout_ms;
+            o.id = arg_value(args, "--id", get_hostname());
+            o.ip = arg_value(args, "--ip", "");
+            if (!parse_duration_ms(arg_value(args, "--interval", "300s"), &o.interval_ms) || o.interval_ms <= 0 ||
+                !parse_duration_ms(arg_value(args, "--max-backoff", "300s"), &o.max_backoff_ms) || o.max_backoff_ms < 1000) {
+                log_err("--interval / --max-backoff must look like 300s, 5m or 1500ms (max-backoff at least 1s)");
+                return 2;
+            }
+            o.jitter = std::min(0.9, std::max(0.0, std::atof(arg_value(args, "--jitter", "0.1").c_str())));
+            o.spool_path = arg_value(args, "--spool", o.spool_path);
+            o.state_path = arg_value(args, "--state", o.state_path);
+            o.probe_timeout_ms = probe_timeout_ms;
+            o.skip_probes = skip_probes;
+            o.tls = tls.get();
+            return run_agent_daemon(o);
+        }
+
+        // --state <file>: remember the acknowledged record and send only changes against it.
+        const std::string state_path = arg_value(args, "--state", "");
+        std::string acked = state_path.empty() ? std::string() : load_agent_state(state_path);
         std::string id = arg_value(args, "--id", "");
 
+        if (id.empty() && !state_path.empty()) {
+            // Keep reporting under the acknowledged id, or a stable one for the first run.
+            std::vector<std::pair<std::string_view, std::string_view>> fields;
+            std::string_view prev;
+            if (json_object_fields(acked, fields)) {
+                for (const auto& f : fields) if (f.first == "id") json_string_contents(f.second, &prev);
+            }
+            id = prev.empty() ? get_hostname() : std::string(prev);
+        }
         if (id.empty()) {
             auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
                           std::chrono::system_clock::now().time_since_epoch()).count();
@@ -672,24 +7032,35 @@ int main(int argc, char** argv) {
         }
         const std::string ip = arg_value(args, "--ip", "");
 
-        const std::string payload = build_asset_json(id, ip);
+        CollectorRegistry probes;
+        register_agent_probes(probes, ip, host, port, std::chrono::milliseconds(probe_timeout_ms));
+        skip_agent_probes(probes, skip_probes);
+        const std::string payload = build_asset_json(probes, id);
 
         std::string why;
-        if (!json_has_required_keys(payload, &why)) {
+        AssetView v;
+        if (!parse_asset_json(payload, v, &why)) {
             log_err("Internal payload schema invalid: " + why);
             return 2;
         }
 
-        log_info("Sending inventory JSON to http://" + host + ":" + std::to_string(port) + path);
-        log_info("Payload: " + payload);
+        std::string send = acked.empty() ? payload : encode_record_change(acked, payload);
+        log_info("Sending inventory JSON to " + scheme + host + ":" + std::to_string(port) + path);
+        if (log_enabled(kLogDebug)) log_debug("Payload: " + send);
 
         int attempt = 0;
         while (attempt <= retries) {
-            int code = http_post_json(host, port, path, payload, timeout_ms);
+            int code = client.request("POST", path, send);
             if (code == 201 || code == 200) {
                 log_info("Send OK (HTTP " + std::to_string(code) + ")");
+                if (!state_path.empty()) save_agent_state(state_path, payload);
                 return 0;
             }
+            if (code == 409 && send != payload) {
+                log_info("Server does not have the acknowledged record; resending in full");
+                send = payload;
+                continue;
+            }
 
             if (code > 0) log_warn("Server response HTTP " + std::to_string(code));
             else log_warn("Network/connection failed (code " + std::to_string(code) + ")");